@@ -0,0 +1,70 @@
+/*
+ * Compares replaying a script as text with lt_run_script against
+ * compiling it once with lt_compile_script and running it with
+ * lt_run_compiled.
+ * Usage: ./bench [LINES] [RUNS]
+ */
+#include "libtalaris.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#define COMMANDS 1000
+
+int noop(int argc, char **argv, LT_Parser *parser) {
+    return 0;
+}
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int lines = argc > 1 ? atoi(argv[1]) : 100000;
+    int runs = argc > 2 ? atoi(argv[2]) : 5;
+
+    LT_Parser *parser = lt_create_parser();
+    char name[32];
+    for(int i = 0; i < COMMANDS; i++) {
+        snprintf(name, 32, "command%d", i);
+        lt_add_command(parser, name, "Does nothing", "Usage: commandN [ARG]...", noop);
+    }
+
+    char script[] = "/tmp/lt_bench_scriptXXXXXX";
+    char compiled[] = "/tmp/lt_bench_compiledXXXXXX";
+    int fd = mkstemp(script);
+    close(mkstemp(compiled));
+    FILE *fp = fdopen(fd, "w");
+    srand(1);
+    for(int i = 0; i < lines; i++) {
+        fprintf(fp, "command%d --limit=%d \"some quoted argument\" file%d.txt", rand() % COMMANDS, rand() % 100, rand() % 50);
+        if(i % 4 == 0) fprintf(fp, " && command%d second command", rand() % COMMANDS);
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+
+    double start = now();
+    for(int i = 0; i < runs; i++) lt_run_script(parser, script);
+    double text = (now() - start) / runs;
+
+    start = now();
+    lt_compile_script(parser, script, compiled);
+    double compile = now() - start;
+
+    start = now();
+    for(int i = 0; i < runs; i++) lt_run_compiled(parser, compiled);
+    double binary = (now() - start) / runs;
+
+    printf("%d lines, average of %d runs\n", lines, runs);
+    printf("text replay:   %8.2f ms\n", text * 1000);
+    printf("compile:       %8.2f ms (once)\n", compile * 1000);
+    printf("compiled run:  %8.2f ms (%.1fx)\n", binary * 1000, text / binary);
+
+    unlink(script);
+    unlink(compiled);
+    lt_cleanup(parser);
+    return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * Creates, exercises and destroys parsers in a loop with counting
+ * allocator hooks, and checks that lt_memory matches what the parser
+ * really holds, that it doesn't grow from one round to the next and
+ * that lt_cleanup gives everything back. Pipelines run their stages
+ * on threads of their own, which `make race` checks with TSan.
+ * Usage: ./check [ROUNDS]
+ */
+#include "libtalaris.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#define COMMANDS 200
+
+/* each allocation is preceded by its size */
+typedef union counted {
+    size_t size;
+    max_align_t align;
+} Counted;
+
+// pipeline stages allocate from threads of their own
+_Atomic size_t live_bytes = 0, live_allocations = 0;
+int failures = 0;
+
+void *count_malloc(size_t size, void *ctx) {
+    Counted *c = malloc(sizeof(Counted) + size);
+    if(c == NULL) return NULL;
+    c->size = size;
+    live_bytes += size;
+    live_allocations++;
+    return c + 1;
+}
+
+void *count_realloc(void *p, size_t size, void *ctx) {
+    if(p == NULL) return count_malloc(size, ctx);
+    Counted *c = (Counted*)p - 1;
+    size_t old = c->size;
+    c = realloc(c, sizeof(Counted) + size);
+    if(c == NULL) return NULL;
+    live_bytes += size - old;
+    c->size = size;
+    return c + 1;
+}
+
+void count_free(void *p, void *ctx) {
+    if(p == NULL) return;
+    Counted *c = (Counted*)p - 1;
+    live_bytes -= c->size;
+    live_allocations--;
+    free(c);
+}
+
+void check(int ok, const char *what, int round) {
+    if(ok) return;
+    fprintf(stderr, "round %d: %s\n", round, what);
+    failures++;
+}
+
+int noop(int argc, char **argv, LT_Parser *parser) {
+    return 0;
+}
+
+int echo(int argc, char **argv, LT_Parser *parser, LT_Stream *in, LT_Stream *out) {
+    for(int i = 1; i < argc; i++) lt_stream_printf(out, "%s\n", argv[i]);
+    return 0;
+}
+
+int count(int argc, char **argv, LT_Parser *parser, LT_Stream *in, LT_Stream *out) {
+    char *line = NULL;
+    size_t cap = 0;
+    int lines = 0;
+    while(lt_stream_getline(in, &line, &cap) != -1) lines++;
+    free(line);
+    lt_stream_printf(out, "%d\n", lines);
+    return 0;
+}
+
+void total(LT_Parser *parser, size_t *bytes, size_t *allocations) {
+    LT_Memory m = lt_memory(parser);
+    *bytes = *allocations = 0;
+    for(int i = 0; i < lt_mem_categories; i++) {
+        *bytes += m.bytes[i];
+        *allocations += m.allocations[i];
+    }
+}
+
+LT_Option options[] = {{'v', "verbose", 0}, {'n', "name", LT_OPT_ARG}, {0}};
+
+void replace(LT_Parser *parser, int pass) {
+    // a removed command, its help and its options leave room for the next
+    LT_Option invalid[] = {{'x', "same", 0}, {'y', "same", 0}, {0}};
+    char name[32], help[64];
+    for(int i = 0; i < COMMANDS; i++) {
+        snprintf(name, 32, "command%d", i);
+        snprintf(help, 64, "Replaced in pass %d", pass % 10);
+        lt_remove_command(parser, name);
+        lt_add_command(parser, name, help, NULL, noop);
+        lt_set_options(parser, name, invalid);
+        lt_set_options(parser, name, options);
+    }
+}
+
+void exercise(LT_Parser *parser, const char *history, int round) {
+    LT_Arg args[] = {{"count", lt_int, 0}, {"file", lt_string, LT_ARG_OPTIONAL}, {0}};
+    char name[32], help[64], line[128];
+
+    lt_output_to_memory(parser);
+    lt_history_open(parser, history, 4096);
+    for(int i = 0; i < COMMANDS; i++) {
+        snprintf(name, 32, "command%d", i);
+        snprintf(help, 64, "Does nothing, %d", i % 7);
+        lt_add_command(parser, name, help, i % 2 ? NULL : "Usage: commandN COUNT [FILE]", noop);
+        lt_set_options(parser, name, options);
+        lt_set_args(parser, name, args);
+    }
+    LT_Command streams[] = {
+        {"echo", "Writes each word on a line", NULL, LT_UNIV, NULL, echo},
+        {"count", "Counts the lines of its input", NULL, LT_UNIV, NULL, count},
+        {NULL}
+    };
+    lt_add_commands(parser, streams);
+    lt_add_alias(parser, "c", "command1 -v 3");
+    lt_set_var(parser, "file", "data.txt");
+    for(int i = 0; i < COMMANDS; i++) {
+        snprintf(line, 128, "command%d --name=x %d $file && c", i, i);
+        lt_call(parser, line);
+        lt_history_add(parser, line);
+    }
+    lt_call(parser, "help");
+    lt_call(parser, "help -k nothing");
+    lt_call(parser, "help command3");
+
+    // the chunks passed along a pipeline come from the hooks too
+    lt_output_clear(parser);
+    lt_call(parser, "echo a b c | count");
+    size_t len;
+    char *out = lt_output_data(parser, &len);
+    check(len == 2 && memcmp(out, "3\n", 2) == 0, "a pipeline gave the wrong output", round);
+
+    // stages that look up or list commands at the same time, after the
+    // commands have changed, share what the parser builds for that
+    lt_add_command(parser, "extra", "Added just before", NULL, noop);
+    lt_call(parser, "nosuchA | nosuchB | count");
+    lt_remove_command(parser, "extra");
+    lt_call(parser, "help | help | count");
+    lt_output_clear(parser);
+
+    size_t bytes, allocations, replaced;
+    replace(parser, 1);
+    total(parser, &replaced, &allocations);
+    replace(parser, 2);
+    total(parser, &bytes, &allocations);
+    check(bytes <= replaced, "replacing commands made the parser hold more", round);
+
+    // captured output fills blocks of many sizes, some only partly and
+    // some bigger than usual for lines longer than a block
+    lt_set_state(parser, "command0", LT_EXEC);
+    lt_call(parser, "help");
+    for(int i = 0; i < COMMANDS * 10; i++) lt_printf(parser, "%0*d\n", i % 50 ? i % 300 : 5000 + i, i);
+    total(parser, &bytes, &allocations);
+    check(bytes == live_bytes, "lt_memory doesn't match the bytes allocated", round);
+    check(allocations == live_allocations, "lt_memory doesn't match the allocations made", round);
+
+    lt_output_clear(parser);
+    total(parser, &bytes, &allocations);
+    check(bytes == live_bytes, "lt_memory doesn't match the bytes allocated after clearing", round);
+
+    lt_remove_alias(parser, "c");
+    lt_unset_var(parser, "file");
+    lt_history_close(parser);
+}
+
+int main(int argc, char **argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 20;
+    char history[] = "/tmp/lt_check_historyXXXXXX";
+    close(mkstemp(history));
+
+    lt_set_allocator(count_malloc, count_realloc, count_free, NULL);
+    size_t baseline_bytes = live_bytes, baseline = live_allocations;
+    size_t held = 0;
+    for(int round = 0; round < rounds; round++) {
+        LT_Parser *parser = lt_create_parser();
+        exercise(parser, history, round);
+
+        // a parser that is reset and used again holds no more than before
+        lt_reset(parser, 1);
+        exercise(parser, history, round);
+        size_t bytes, allocations;
+        total(parser, &bytes, &allocations);
+        if(round == 0) held = bytes;
+        check(bytes <= held, "the parser holds more than in the first round", round);
+
+        lt_cleanup(parser);
+        check(live_allocations == baseline, "lt_cleanup left allocations behind", round);
+        check(live_bytes == baseline_bytes, "lt_cleanup left bytes behind", round);
+    }
+    unlink(history);
+
+    if(failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("%d rounds, %zu bytes held after each\n", rounds, held);
+    return 0;
+}
@@ -1,118 +1,180 @@
+#define _GNU_SOURCE
 #include "libtalaris.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <errno.h>
 
-int echo(int argc, char **argv, LT_Parser *caller) {
+int echo(int argc, char **argv, LT_Parser *caller, LT_Stream *in, LT_Stream *out) {
     for(int i = 1; i < argc; i++) {
-        printf("%s%s", argv[i], i != argc-1 ? " " : "\n");
+        lt_stream_printf(out, "%s%s", argv[i], i != argc-1 ? " " : "\n");
     }
     return 0;
 }
 
-int cat(int argc, char **argv, LT_Parser *caller) {
+int cat(int argc, char **argv, LT_Parser *caller, LT_Stream *in, LT_Stream *out) {
+    if(argc == 1) {
+        // pass the input straight through
+        char *chunk;
+        size_t len;
+        while((chunk = lt_stream_pull(in, &len)) != NULL) {
+            if(lt_stream_push(out, chunk, len) != 0) break;
+        }
+        return 0;
+    }
     for(int i = 1; i < argc; i++) {
         FILE *fp = fopen(argv[i], "r");
         if(fp == NULL) continue;
         char buffer[1024];
-        while(fgets(buffer, 1024, fp) != NULL) {
-            printf("%s", buffer);
+        size_t len;
+        while((len = fread(buffer, 1, 1024, fp)) > 0) {
+            if(lt_stream_write(out, buffer, len) != 0) break;
         }
+        fclose(fp);
     }
     return 0;
 }
 
-int quiet(int argc, char **argv, LT_Parser *caller) {
-    printf("THIS IS QUIET\n");
+int filter(int argc, char **argv, LT_Parser *caller, LT_Stream *in, LT_Stream *out) {
+    if(argc < 2) {
+        lt_printf(caller, "You must specify a word to filter by\n");
+        return 1;
+    }
+    // -v prints the lines that don't match, -i ignores case
+    int invert = lt_opt_count(caller, "invert") > 0;
+    char *(*search)(const char*, const char*) = lt_opt_count(caller, "i") ? strcasestr : strstr;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while((len = lt_stream_getline(in, &line, &cap)) != -1) {
+        if((search(line, argv[1]) == NULL) == invert && lt_stream_write(out, line, len) != 0) break;
+    }
+    free(line);
     return 0;
 }
 
-int secret(int argc, char**argv, LT_Parser *caller) {
-    printf("THIS IS A SECRET!\n");
+int count(int argc, char **argv, LT_Parser *caller, LT_Stream *in, LT_Stream *out) {
+    char *line = NULL;
+    size_t cap = 0;
+    int lines = 0;
+    while(lt_stream_getline(in, &line, &cap) != -1) lines++;
+    free(line);
+    lt_stream_printf(out, "%d\n", lines);
     return 0;
 }
 
-int silent(int argc, char **argv, LT_Parser *caller) {
-    printf("YOU SHOULD NEVER SEE THIS\n");
+int quiet(int argc, char **argv, LT_Parser *caller) {
+    lt_printf(caller, "THIS IS QUIET\n");
     return 0;
 }
 
-int is_num(char *str) {
-    char *tmp;
-    long val = strtol(str, &tmp, 10);
+int secret(int argc, char**argv, LT_Parser *caller) {
+    lt_printf(caller, "THIS IS A SECRET!\n");
+    return 0;
+}
 
-    return !((tmp == str) || (*tmp !='\0'));
+int silent(int argc, char **argv, LT_Parser *caller) {
+    lt_printf(caller, "YOU SHOULD NEVER SEE THIS\n");
+    return 0;
 }
 
 int add(int argc, char **argv, LT_Parser *caller) {
+    int count;
+    lt_args(caller, &count);
     int sum = 0;
-    for(int i = 1; i < argc; i++) {
-        sum += atoi(argv[i]);
+    for(int i = 0; i < count; i++) {
+        sum += lt_arg_int(caller, i);
     }
     return sum;
 }
 
 int mul(int argc, char **argv, LT_Parser *caller) {
+    int count;
+    lt_args(caller, &count);
     int sum = 1;
-    for(int i = 1; i < argc; i++) {
-        if(is_num(argv[i])) sum *= atoi(argv[i]);
+    for(int i = 0; i < count; i++) {
+        sum *= lt_arg_int(caller, i);
     }
     return sum;
 }
 
 int set(int argc, char **argv, LT_Parser *caller) {
-    if(argc < 2) {
-        return 0;
-    }
-    if(is_num(argv[1])) return atoi(argv[1]);
-    printf("That was not a valid integer!\n");
-    return INT32_MAX;
+    // the argument is optional, and lt_arg_int gives 0 without it
+    return lt_arg_int(caller, 0);
 }
 
 int exit_math(int argc, char **argv, LT_Parser *caller) {
-    return LT_CALL_FAILED;
+    // math() leaves the loop when it sees this command's ID
+    return 0;
 }
 
-int math(int argc, char **argv, LT_Parser *caller) {
-    LT_Parser *mathparser = lt_create_parser();
+static void add_math_commands(LT_Parser *mathparser) {
+    LT_Arg integers[] = {
+        {"INTEGER", lt_int, 0},
+        {"INTEGER", lt_int, LT_ARG_OPTIONAL | LT_ARG_REPEAT},
+        {0}
+    };
+    LT_Arg integer[] = {{"INTEGER", lt_int, LT_ARG_OPTIONAL}, {0}};
     LT_Command mathcoms[] = {
-        {"add", "adds integers", "Usage: add INTEGER [INTEGER]...", LT_UNIV, add, NULL},
-        {"sub", "subtracts integers", "Usage: sub INTEGER [INTEGER]...", LT_UNIV, add, NULL},
-        {"mul", "multiplies integers", "Usage: mul INTEGER [INTEGER]...", LT_UNIV, mul, NULL},
-        {"div", "divides integers", "Usage: div INTEGER [INTEGER]...", LT_UNIV, mul, NULL},
-        {"reset", "sets the current stored value (default 0)", "Usage: reset [INTEGER]", LT_UNIV, set, NULL},
+        {"add", "adds integers", "Usage: add INTEGER [INTEGER]...", LT_UNIV, add, NULL, integers},
+        {"sub", "subtracts integers", "Usage: sub INTEGER [INTEGER]...", LT_UNIV, add, NULL, integers},
+        {"mul", "multiplies integers", "Usage: mul INTEGER [INTEGER]...", LT_UNIV, mul, NULL, integers},
+        {"div", "divides integers", "Usage: div INTEGER [INTEGER]...", LT_UNIV, mul, NULL, integers},
+        {"reset", "sets the current stored value (default 0)", "Usage: reset [INTEGER]", LT_UNIV, set, NULL, integer},
         {0}
     };
-    char *matches[] = {"add", "sub", "mul", "div", "reset", NULL};
     lt_add_commands(mathparser, mathcoms);
+    mathparser->abbreviate = 1;
     lt_get_command(mathparser, "exit")->callback = exit_math;
+}
+
+int math(int argc, char **argv, LT_Parser *caller) {
+    // kept between visits, and reset so each one starts afresh
+    static LT_Parser *mathparser = NULL;
+    if(mathparser != NULL) {
+        lt_reset(mathparser, 0);
+    } else {
+        mathparser = lt_create_parser();
+        add_math_commands(mathparser);
+    }
+    // commands get consecutive IDs in the order they are added
+    enum {ADD, SUB, MUL, DIV, RESET};
+    int first_id = lt_command_id(mathparser, "add");
+    int exit_id = lt_command_id(mathparser, "exit");
 
     char prompt[128];
     int total = 0;
-    int val = 0;
+    LT_Result r;
     snprintf(prompt, 128, "%d\n# ", total);
     mathparser->prompt = prompt;
-    while((val = lt_input(mathparser, matches)) != LT_CALL_FAILED) {
-        if(val == INT32_MAX || mathparser->argc == 0 || val == LT_COMMAND_NOT_FOUND) continue;
+    while((r = lt_dispatch_input(mathparser, NULL)).status != lt_end_of_input) {
+        if(r.status != lt_ok) continue;
+        if(r.id == exit_id) break;
 
         int old_total = total;
+        int val = r.retval;
         char operation = '?';
 
-        if(strncmp(mathparser->argv[0], "add", 4) == 0) {
-            total += val;
-            operation = '+';
-        } else if(strncmp(mathparser->argv[0], "sub", 4) == 0) {
-            total -= val;
-            operation = '-';
-        } else if(strncmp(mathparser->argv[0], "mul", 4) == 0) {
-            total *= val;
-            operation = '*';
-        } else if(strncmp(mathparser->argv[0], "div", 4) == 0) {
-            total /= val ? val : 1;
-            operation = '/';
-        } else if(strncmp(mathparser->argv[0], "reset", 4) == 0) {
-            total = val;
+        switch(r.id - first_id) {
+            case ADD:
+                total += val;
+                operation = '+';
+                break;
+            case SUB:
+                total -= val;
+                operation = '-';
+                break;
+            case MUL:
+                total *= val;
+                operation = '*';
+                break;
+            case DIV:
+                total /= val ? val : 1;
+                operation = '/';
+                break;
+            case RESET:
+                total = val;
+                break;
         }
 
         if(operation == '?') {
@@ -123,8 +185,7 @@ int math(int argc, char **argv, LT_Parser *caller) {
         mathparser->prompt = prompt;
     }
 
-    printf("Exiting mathematics mode\n");
-    lt_cleanup(mathparser);
+    lt_printf(caller, "Exiting mathematics mode\n");
     return 0;
 }
 
@@ -134,15 +195,17 @@ int mainexit(int argc, char **argv, LT_Parser *parser) {
 
 int arguments(int argc, char **argv, LT_Parser *parser) {
     for(int i = 0; i < argc; i++) {
-        printf("\"%s\"%s", argv[i], i < argc-1 ? " " : "\n");
+        lt_printf(parser, "\"%s\"%s", argv[i], i < argc-1 ? " " : "\n");
     }
+    return 0;
 }
 
 int exec(int argc, char **argv, LT_Parser *parser) {
     if (argc < 2) {
-        printf("You must specify a binary\n");
+        lt_printf(parser, "You must specify a binary\n");
         return 0;
     }
+    lt_flush(parser);
     if (fork() == 0) {
         char *envp = {NULL};
         int res = execve(argv[1], &argv[1], &envp);
@@ -157,28 +220,40 @@ int exec(int argc, char **argv, LT_Parser *parser) {
 
 int main(void) {
     LT_Parser *parser = lt_create_parser();
+    LT_Option filter_options[] = {
+        {'v', "invert", 0},
+        {'i', "ignore-case", 0},
+        {0}
+    };
     LT_Command commands[] = {
-        {"echo", "Echos whatever you write", "Usage: echo [WORD]...", LT_UNIV, echo,  NULL},
-        {"cat", "Prints the contents of whichever file(s) you specify", "Usage: cat [FILE]...", LT_UNIV, cat, NULL},
+        {"echo", "Echos whatever you write", "Usage: echo [WORD]...", LT_UNIV, NULL, echo},
+        {"cat", "Prints the contents of whichever file(s) you specify, or its input", "Usage: cat [FILE]...", LT_UNIV, NULL, cat, NULL, NULL, lt_complete_paths},
+        {"filter", "Prints the lines of its input containing a word", "Usage: COMMAND | filter [-v|--invert] [-i|--ignore-case] WORD", LT_UNIV, NULL, filter, NULL, filter_options},
+        {"count", "Counts the lines of its input", "Usage: COMMAND | count", LT_UNIV, NULL, count},
         {"math", "Enters mathematics mode", "Usage: math", LT_UNIV, math, NULL},
         {"args", "Prints out each argument", "Usage: args [WORD]...", LT_UNIV, arguments, NULL},
         {"quiet", "This is a quiet command. You can't see it in help, but you can if you run `help quiet`, and you can run it", "Usage: quiet", LT_EXEC | LT_SPEC, quiet, NULL},
         {"secret", "This is a secret command. It does not show up in help, but you can run it", "Usage: secret", LT_EXEC, secret, NULL},
         {"silent", "This is a silent command. It does not show up in help, and you can not run it", "Usage: silent", LT_HIDE, silent, NULL},
-        {"?", "A link to help", "Usage: ? [COMMAND]...", LT_EXEC | LT_SPEC, lt_help, NULL},
-        {"exec", "execute a binary", "Usage: exec [BINARY]", LT_UNIV, exec, NULL},
+        {"?", "A link to help", "Usage: ? [COMMAND]...", LT_EXEC | LT_SPEC, lt_help, NULL, NULL, NULL, lt_complete_commands},
+        {"exec", "execute a binary", "Usage: exec [BINARY]", LT_UNIV, exec, NULL, NULL, NULL, lt_complete_paths},
+        {"alias", "Defines or lists aliases", "Usage: alias [NAME[=COMMAND]]...", LT_UNIV, lt_alias, NULL},
+        {"unalias", "Removes aliases", "Usage: unalias NAME...", LT_UNIV, lt_unalias, NULL},
+        {"set", "Sets or lists variables, used as $NAME", "Usage: set [NAME [VALUE]...]", LT_UNIV, lt_set, NULL, NULL, NULL, lt_complete_vars},
+        {"unset", "Removes variables", "Usage: unset NAME...", LT_UNIV, lt_unset, NULL, NULL, NULL, lt_complete_vars},
+        {"apropos", "Finds commands by the words in their help", "Usage: apropos WORD...", LT_UNIV, lt_apropos, NULL},
         {0}
     };
 
-    char *matches[] = {"echo", "cat", "quiet", "help", "exit", "math", "args", "exec", NULL};
-
     lt_add_commands(parser, commands);
+    parser->abbreviate = 1;
+    lt_history_open(parser, ".example_history", 0);
 
     lt_get_command(parser, "exit")->callback = mainexit;
 
     int val = 0;
     do {
-        val = lt_input(parser, matches);
+        val = lt_input(parser, NULL);
     } while(val != LT_CALL_FAILED);
     lt_cleanup(parser);
     return 0;
@@ -1,38 +1,39 @@
+#include "ltalloc.h"
 #include "libtalaris.h"
 #include "uthash.h"
 #include "wordsplit.h"
+#include "ltoutput.h"
+#include "ltcall.h"
 #include <stdlib.h>
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <readline/readline.h>
 #include <readline/history.h>
-
-char **matching_commands = NULL;
+#include <pthread.h>
+#include <time.h>
 
 int lt_help(int argc, char **argv, LT_Parser *parser) {
     assert(parser != NULL);
+    if(argc > 1 && strcmp(argv[1], "-k") == 0) return lt_apropos(argc-1, argv+1, parser);
     if(argc == 1) {
         //The command 'help' only was called
-        LT_Command *s, *tmp;
-        HASH_ITER(hh, parser->commands, s, tmp) {
-            if(LT_IS_HELP(s->state)) {
-                printf("%s", s->key);
-                if(s->help) {
-                    printf("\t%s\n",s->help);
-                } else {
-                    printf("\n");
-                }
-            }
-        }
+        help_list(parser);
     } else {
         // show extended help for each command in argv
         for(int i = 1; i < argc; i++) {
             LT_Command *c = lt_get_command(parser, argv[i]);
             if(c == NULL || !(LT_IS_SPEC(c->state))) {
-                printf("Could not find command %s\n", argv[i]);
+                lt_printf(parser, "Could not find command %s\n", argv[i]);
             } else {
-                printf("%s\t%s\n", c->key, c->help == NULL ? "This command has no help text" : c->help);
-                if(c->help_extended) printf("\t%s\n", c->help_extended);
+                int len;
+                const char *help = command_help(parser, c, 0, &len);
+                if(help == NULL) {
+                    lt_printf(parser, "%s\tThis command has no help text\n", c->key);
+                } else {
+                    lt_printf(parser, "%s\t%.*s\n", c->key, len, help);
+                }
+                print_usage(parser, c, "\t");
             }
         }
     }
@@ -45,26 +46,61 @@ int lt_exit(int argc, char **argv, LT_Parser *parser) {
 }
 
 int lt_unfound(int argc, char **argv, LT_Parser *parser) {
-    printf("The command '%s' was not found. Try typing 'help' to see a list of full commands\n", argc > 0 ? argv[0] : "");
+    char *suggestions[LT_SUGGEST_MAX];
+    int count = argc > 0 ? lt_suggest(parser, argv[0], suggestions, LT_SUGGEST_MAX) : 0;
+    if(count > 0) {
+        lt_printf(parser, "The command '%s' was not found. Did you mean", argv[0]);
+        for(int i = 0; i < count; i++) {
+            lt_printf(parser, "%s '%s'", i == 0 ? "" : i == count-1 ? " or" : ",", suggestions[i]);
+        }
+        lt_printf(parser, "?\n");
+        return 0;
+    }
+    lt_printf(parser, "The command '%s' was not found. Try typing 'help' to see a list of full commands\n", argc > 0 ? argv[0] : "");
     return 0;
 }
 
+static void add_defaults(LT_Parser *parser) {
+    // the commands every parser starts with
+    lt_add_command(parser, "help", "Shows this help", "Usage: help [COMMAND]...\n\thelp -k WORD...\tLists the commands whose help mentions a word", lt_help);
+    lt_set_completer(parser, "help", lt_complete_commands);
+    lt_add_command(parser, "exit", "Exits the program", "Usage: exit", lt_exit);
+}
 
 LT_Parser *lt_create_parser(void) {
-    LT_Parser *parser = malloc(sizeof(LT_Parser));
+    LT_Parser *parser = lt_malloc(sizeof(LT_Parser));
     assert(parser);
     parser->commands = NULL;
+    parser->aliases = NULL;
+    parser->vars = NULL;
+    parser->generation = 0;
     parser->verbosity = lt_normal;
 
     parser->argc = 0;
     parser->argv = NULL;
+    parser->command_id = LT_NO_COMMAND;
+    parser->next_id = 0;
     parser->prompt = "> ";
+    parser->output = output_create();
+    parser->abbreviate = 0;
+    parser->history = NULL;
+    parser->sorted = NULL;
+    parser->masks = NULL;
+    parser->lengths = NULL;
+    parser->nsorted = 0;
+    parser->sorted_generation = -1;
+    parser->help_terms = NULL;
+    memset(parser->views, 0, sizeof(parser->views));
+    parser->listing = NULL;
+    parser->catalog = NULL;
+    parser->pool = NULL;
+    parser->help_loader = NULL;
+    parser->help_loader_ctx = NULL;
+    parser->help_page = 0;
 
     parser->unfound = lt_unfound;
 
-    lt_add_command(parser, "help", "Shows this help", "Usage: help [COMMAND]...", lt_help);
-    lt_add_command(parser, "exit", "Exits the program", "Usage: exit", lt_exit);
-
+    add_defaults(parser);
     return parser;
 }
 
@@ -75,6 +111,15 @@ LT_Command *lt_get_command(LT_Parser *parser, char *command) {
     return c;
 }
 
+int lt_command_id(LT_Parser *parser, char *command) {
+    /*
+     * Returns the ID given to a command when it was added,
+     * or LT_NO_COMMAND if there is no such command
+     */
+    LT_Command *c = lt_get_command(parser, command);
+    return c ? c->id : LT_NO_COMMAND;
+}
+
 int add_command_to_parser(LT_Parser *parser, LT_Command *command) {
     assert(parser);
     assert(command);
@@ -83,10 +128,25 @@ int add_command_to_parser(LT_Parser *parser, LT_Command *command) {
         return 1;
     }
 
+    // IDs are never reused, so a stale ID can't match a newer command
+    command->id = parser->next_id++;
     HASH_ADD_KEYPTR(hh, parser->commands, command->key, strlen(command->key), command);
+    view_add(parser, command);
+    help_index_add(parser, command);
+    parser->generation++;
     return 0;
 }
 
+static void release_command(LT_Parser *parser, LT_Command *c) {
+    // gives a command that is no longer in the parser back to the pool
+    pool_drop(parser, c->key);
+    pool_drop(parser, c->help);
+    pool_drop(parser, c->help_extended);
+    clear_schema(parser, c);
+    clear_options(parser, c);
+    pool_release(parser, c, 1, sizeof(LT_Command), lt_mem_commands);
+}
+
 int lt_add_command(LT_Parser *parser, char *command, char *help, char *help_extended, int (*callback)(int, char**, LT_Parser *)) {
     /*
      * Add a command to the parser
@@ -96,206 +156,784 @@ int lt_add_command(LT_Parser *parser, char *command, char *help, char *help_exte
 
     if(command == NULL || command[0] == '\0') return 1;
 
-    LT_Command *c = malloc(sizeof(LT_Command));
-    c->key = strdup(command);
-    assert(c->key);
-    c->help = strdup(help);
-    assert(c->help);
-    c->help_extended = strdup(help_extended);
+    // the command lives in the parser's pool until it's removed
+    LT_Command *c = pool_calloc(parser, 1, sizeof(LT_Command), lt_mem_commands);
+    // commands without help get it from the catalog or loader when it's asked for
+    c->key = pool_intern(parser, command);
+    c->help = pool_intern(parser, help);
+    c->help_extended = pool_intern(parser, help_extended);
     c->callback = callback;
     c->state = LT_UNIV;
 
-    int retval = add_command_to_parser(parser, c);
-    if(retval != 0) {
-        free(c->key);
-        free(c->help);
-        free(c->help_extended);
-        free(c);
+    if(add_command_to_parser(parser, c) != 0) {
+        release_command(parser, c);
+        return 1;
     }
-    return retval;
+    return 0;
 }
 
 int lt_add_commands(LT_Parser *parser, LT_Command *commands) {
     assert(parser);
     int count = 0;
     for(int i = 0; commands[i].key != NULL; i++) {
-        LT_Command *c = malloc(sizeof(LT_Command));
-        c->key = strdup(commands[i].key);
-        assert(c->key);
-        c->help = strdup(commands[i].help);
-        assert(c->help);
-        c->help_extended = strdup(commands[i].help_extended);
-        assert(c->help_extended);
+        LT_Command *c = pool_calloc(parser, 1, sizeof(LT_Command), lt_mem_commands);
+        c->key = pool_intern(parser, commands[i].key);
+        c->help = pool_intern(parser, commands[i].help);
+        c->help_extended = pool_intern(parser, commands[i].help_extended);
         c->state = commands[i].state;
         c->callback = commands[i].callback;
-        count += (add_command_to_parser(parser, c) == 0);
+        c->stream = commands[i].stream;
+        c->complete = commands[i].complete;
+        if(compile_args(parser, c, commands[i].args) != 0 && parser->verbosity >= lt_warning) {
+            fprintf(stderr, "Warning: Ignoring the invalid argument schema of '%s'\n", c->key);
+        }
+        if(compile_options(parser, c, commands[i].options) != 0 && parser->verbosity >= lt_warning) {
+            fprintf(stderr, "Warning: Ignoring the invalid options of '%s'\n", c->key);
+        }
+        if(add_command_to_parser(parser, c) == 0) count++;
+        else release_command(parser, c);
     }
     return count;
 }
 
-void free_command(LT_Command *c) {
-    free(c->help);
-    free(c->help_extended);
-    free(c->key);
-    free(c);
-}
-
 int lt_remove_command(LT_Parser *parser, char *command) {
     assert(parser != NULL);
     LT_Command *to_delete = lt_get_command(parser, command);
     if(to_delete == NULL) return 1;
     HASH_DEL(parser->commands, to_delete);
-    free_command(to_delete);
+    view_remove(parser, to_delete);
+    help_index_remove(parser, to_delete);
+    release_command(parser, to_delete);
+    parser->generation++;
     return 1;
 }
 
-int lt_call(LT_Parser *parser, char *str) {
-    /*
-     * Parses the arguments in string and
-     * executes the appropriate callback
-     */
-    if(parser == NULL) return LT_CALL_FAILED;
-    // free the old commands
-    for(int i = 0; i < parser->argc; i++) {
-        free(parser->argv[i]);
-    }
-    free(parser->argv);
+void free_args(LT_Parser *parser) {
+    lt_free(parser->argv);
     parser->argv = NULL;
     parser->argc = 0;
-    if(str == NULL) return LT_CALL_FAILED;
-
-    parser->argc = ws_split(str, &parser->argv);
-    if(parser->verbosity >= lt_verbose) {
-        printf("Collected %d arguments. They are:\n", parser->argc);
-        for(int i = 0; i < parser->argc; i++) printf("'%s'%s", parser->argv[i], i == parser->argc-1 ? "\n" : " ");
-    }
+}
 
-    char *command = parser->argv[0];
-    LT_Command *c = lt_get_command(parser,command);
+void call_command(LT_Stage *stage) {
+    /*
+     * Executes the callback for the stage's command, which is looked
+     * up by argv[0] if it hasn't been already. The stage's status
+     * is left as lt_ok if the callback ran, and otherwise says why
+     */
+    LT_Parser *parser = stage->parser;
+    LT_Command *c = stage->command;
+    int argc = stage->argc;
+    char **argv = stage->argv;
+    LT_Stream *in = stage->in, *out = stage->out;
+    lt_status *status = &stage->status;
+
+    if(c == NULL) c = lt_get_command(parser, argv[0]);
     int retval;
-    if(c && LT_IS_EXEC(c->state)) {
-        if(c->callback == NULL) {
+    LT_Value values[LT_MAX_ARGS];
+    LT_Opt_Value opts[LT_MAX_OPTIONS];
+    LT_Context context = {c, NULL, 0, NULL};
+    char **positional = NULL;
+    if(c && LT_IS_EXEC(c->state) && c->opt_table != NULL) {
+        // the callback only sees the words that aren't options
+        positional = lt_malloc(sizeof(char*) * (argc + 1));
+        assert(positional);
+        argc = parse_options(parser, c, argc, argv, positional, opts);
+        argv = positional;
+        context.opts = opts;
+        if(argc < 0) context.count = -1;
+    }
+    if(c && LT_IS_EXEC(c->state) && c->args != NULL && context.count == 0) {
+        // check the arguments before the callback sees them
+        context.count = convert_args(parser, c, argc, argv, values);
+        context.values = values;
+    }
+    LT_Context *old = context_swap(&context);
+    if(*status == lt_ambiguous) {
+        print_candidates(parser, argv[0]);
+        retval = LT_COMMAND_NOT_FOUND;
+    } else if(context.count < 0) {
+        retval = LT_BAD_ARGUMENTS;
+        *status = lt_bad_arguments;
+    } else if(c && LT_IS_EXEC(c->state)) {
+        if(c->stream != NULL) {
+            retval = c->stream(argc, argv, parser, in, out);
+        } else if(c->callback == NULL) {
             if(parser->verbosity >= lt_warning) fprintf(stderr, "Warning: Command '%s' has no callback\n", c->key);
             retval = LT_CALL_FAILED;
+            *status = lt_no_callback;
         } else {
-            retval = c->callback(parser->argc, parser->argv, parser);
+            retval = c->callback(argc, argv, parser);
         }
     } else {
         if(parser->unfound != NULL) {
-            parser->unfound(parser->argc, parser->argv, parser);
+            parser->unfound(argc, argv, parser);
         }
         retval = LT_COMMAND_NOT_FOUND;
+        *status = lt_not_found;
     }
+    context_swap(old);
+    lt_free(positional);
 
-    return retval;
+    stage->retval = retval;
 }
 
-char **generate_command_list(LT_Parser *parser) {
-    //TODO: move the command list from here into the LT_Parser struct
-    int count = HASH_COUNT(parser->commands);
-    char **command_list = malloc(sizeof(char*) * (count+1));
-    assert(command_list);
-    int c = 0;
-    LT_Command *s, *tmp;
-    HASH_ITER(hh, parser->commands, s, tmp) {
-        if(LT_IS_SHOW(s->state)) {
-            command_list[c++] = strdup(s->key);
+void exec_push(LT_Exec *e, int argc, char **argv, ws_op op, LT_Command *command) {
+    /*
+     * Queues a command, taking ownership of argv
+     */
+    if(e->count == e->cap) {
+        e->cap = e->cap ? e->cap * 2 : 4;
+        e->stages = lt_realloc(e->stages, sizeof(LT_Stage) * e->cap);
+        assert(e->stages);
+    }
+    LT_Stage *stage = &e->stages[e->count++];
+    stage->command = command;
+    stage->argc = argc;
+    stage->argv = argv;
+    stage->op = op;
+    stage->status = lt_ok;
+}
+
+void exec_free(LT_Exec *e) {
+    for(int i = 0; i < e->count; i++) lt_free(e->stages[i].argv);
+    lt_free(e->stages);
+    e->stages = NULL;
+    e->count = e->cap = 0;
+}
+
+static void *run_stage(void *arg) {
+    /*
+     * Anything the stage prints with lt_printf goes to the next stage,
+     * or to the parser's output for the last stage
+     */
+    LT_Stage *stage = arg;
+    LT_Output *o = stage->out ? output_for_stream(stage->out) : stage->parser->output;
+    LT_Output *old = output_swap(o);
+    call_command(stage);
+    output_flush(o);
+    output_swap(old);
+    if(stage->out) output_destroy(o);
+    // let the next stage see the end of the data, and stop the previous one writing
+    lt_stream_close(stage->out);
+    lt_stream_abandon(stage->in);
+    return NULL;
+}
+
+int run_pipeline(LT_Parser *parser, LT_Stage *stages, int count) {
+    /*
+     * Runs each stage on its own thread, connected by bounded streams.
+     * The last stage runs on the calling thread and its
+     * return value is the pipeline's
+     */
+    // the stages share the parser, so what it builds when first needed
+    // is brought up to date now rather than by several stages at once
+    command_index(parser);
+    view_get(parser, LT_VIEW_SHOW);
+    help_prepare(parser);
+
+    LT_Stream **streams = lt_malloc(sizeof(LT_Stream*) * (count-1));
+    assert(streams);
+    for(int i = 0; i < count; i++) {
+        stages[i].parser = parser;
+        stages[i].in = i > 0 ? streams[i-1] : NULL;
+        stages[i].out = NULL;
+        if(i < count-1) {
+            streams[i] = lt_stream_create(LT_STREAM_CAPACITY);
+            stages[i].out = streams[i];
+            if(pthread_create(&stages[i].thread, NULL, run_stage, &stages[i]) != 0) {
+                assert(!"could not create pipeline thread");
+            }
         }
     }
-    command_list[c] = NULL;
-    return command_list;
+    run_stage(&stages[count-1]);
+    // a stream is still read by the stage after the one writing it
+    for(int i = 0; i < count-1; i++) pthread_join(stages[i].thread, NULL);
+    for(int i = 0; i < count-1; i++) lt_stream_destroy(streams[i]);
+    lt_free(streams);
+    return stages[count-1].retval;
 }
 
-char *command_generator(const char *text, int state) {
-    static int list_index, len;
-    char *command;
+LT_Alias *find_alias(LT_Parser *parser, char *name) {
+    LT_Alias *a = NULL;
+    if(name != NULL) HASH_FIND_STR(parser->aliases, name, a);
+    return a;
+}
 
-    if(!state) {
-        list_index = 0;
-        len = strlen(text);
+static void expand_aliases(LT_Parser *parser, LT_Exec *e, int argc, char **argv, ws_op op, char **active, int depth) {
+    /*
+     * Queues the command in argv, replacing a leading alias with the
+     * commands stored for it. The last of those gets the rest of argv
+     * and op. An alias is not expanded again inside its own expansion.
+     * Takes ownership of argv
+     */
+    LT_Alias *a = argc > 0 ? find_alias(parser, argv[0]) : NULL;
+    for(int i = 0; a != NULL && i < depth; i++) {
+        if(active[i] == a->key) a = NULL;
+    }
+    if(a != NULL && depth == LT_ALIAS_DEPTH) {
+        if(parser->verbosity >= lt_warning) fprintf(stderr, "Warning: Aliases nested too deeply to expand '%s'\n", a->key);
+        a = NULL;
+    }
+    if(a == NULL) {
+        exec_push(e, argc, argv, op, NULL);
+        return;
     }
-    while((command = matching_commands[list_index++])) {
-        if(strncmp(command, text, len) == 0) {
-            return strdup(command);
+
+    active[depth] = a->key;
+    for(int i = 0; i < a->count || (i == 0 && a->count == 0); i++) {
+        WS_Builder b = {0};
+        int last = i >= a->count - 1;
+        if(a->count > 0) {
+            WS_Range *r = &a->ranges[i];
+            for(int j = 0; j < r->argc; j++) ws_word(&b, a->argv[r->start + j]);
+        }
+        if(last) {
+            for(int j = 1; j < argc; j++) ws_word(&b, argv[j]);
         }
+        int words = b.nslots;
+        char **expanded = ws_build(&b);
+        expand_aliases(parser, e, words, expanded, last ? op : a->ranges[i].op, active, depth + 1);
     }
-    return NULL;
+    lt_free(argv);
 }
 
-char **command_completion(const char *text, int start, int end) {
-    rl_attempted_completion_over = 1;
-    return rl_completion_matches(text, command_generator);
+void exec_alias(LT_Parser *parser, LT_Exec *e, int argc, char **argv, ws_op op) {
+    char *active[LT_ALIAS_DEPTH];
+    expand_aliases(parser, e, argc, argv, op, active, 0);
 }
 
-int lt_input(LT_Parser *parser, char **_matching_commands) {
+static void trace(LT_Parser *parser, LT_Stage *stages, int count) {
     /*
-     * Reads from stdin and executes lt_call
+     * Writes the words of each stage to the parser's output, before
+     * any of them run so that none of it goes down a pipeline
+     */
+    LT_Output *old = output_swap(parser->output);
+    for(int s = 0; s < count; s++) {
+        lt_printf(parser, "Collected %d arguments. They are:\n", stages[s].argc);
+        for(int i = 0; i < stages[s].argc; i++) {
+            lt_printf(parser, "'%s'%s", stages[s].argv[i], i == stages[s].argc-1 ? "\n" : " ");
+        }
+    }
+    output_swap(old);
+}
+
+static int chain_broken(LT_Exec *e) {
+    // decided by what happened, so a callback may return any value
+    return e->status == lt_no_callback || e->status == lt_failed;
+}
+
+void exec_run(LT_Parser *parser, LT_Exec *e, int more) {
+    /*
+     * Executes the whole pipelines at the front of the queue.
+     * more is set if further commands may still be queued
+     */
+    while(e->count > 0 && !chain_broken(e)) {
+        int end = 0;
+        while(end < e->count && e->stages[end].op == WS_PIPE) end++;
+        if(end == e->count) {
+            if(more) return;
+            end = e->count - 1;
+        }
+
+        // drop empty commands from the pipeline
+        int count = 0;
+        for(int i = 0; i <= end; i++) {
+            if(e->stages[i].argc == 0 && (count > 0 || i < end)) {
+                lt_free(e->stages[i].argv);
+            } else {
+                e->stages[count++] = e->stages[i];
+            }
+        }
+        LT_Stage *stages = e->stages;
+        ws_op next = stages[count-1].op;
+
+        int skip = (e->prev == WS_AND && e->retval != 0) || (e->prev == WS_OR && e->retval == 0);
+        // empty commands are skipped unless the whole line is empty
+        if(stages[0].argc == 0 && (e->executed || more || e->count > end+1)) skip = 1;
+        if(skip) {
+            for(int i = 0; i < count; i++) lt_free(stages[i].argv);
+        } else {
+            free_args(parser);
+            for(int i = 0; i < count; i++) {
+                if(stages[i].command == NULL && stages[i].argc > 0) {
+                    stages[i].command = resolve_command(parser, stages[i].argv[0], &stages[i].status);
+                }
+            }
+            if(parser->verbosity >= lt_verbose) trace(parser, stages, count);
+            if(count == 1) {
+                LT_Output *old = output_swap(parser->output);
+                stages[0].parser = parser;
+                stages[0].in = stages[0].out = NULL;
+                call_command(&stages[0]);
+                e->retval = stages[0].retval;
+                output_flush(parser->output);
+                output_swap(old);
+            } else {
+                e->retval = run_pipeline(parser, stages, count);
+                for(int i = 0; i < count-1; i++) lt_free(stages[i].argv);
+            }
+            LT_Command *last = stages[count-1].command;
+            parser->argc = stages[count-1].argc;
+            parser->argv = stages[count-1].argv;
+            parser->command_id = last && LT_IS_EXEC(last->state) ? last->id : LT_NO_COMMAND;
+            e->status = stages[count-1].status;
+            e->executed = 1;
+        }
+        e->prev = next;
+        e->count -= end+1;
+        memmove(e->stages, e->stages + end+1, sizeof(LT_Stage) * e->count);
+    }
+}
+
+const char *var_value(const char *name, int len, void *ctx) {
+    LT_Parser *parser = ctx;
+    LT_Var *v = NULL;
+    HASH_FIND(hh, parser->vars, name, len, v);
+    return v ? v->value : NULL;
+}
+
+static int run_line(LT_Parser *parser, char *str, LT_Exec *e) {
+    /*
+     * Executes each command in str as its turn comes,
+     * leaving the state of the chain in e
+     */
+    WS_Scanner scanner;
+    ws_init(&scanner, str, WS_CHAIN);
+    scanner.lookup = var_value;
+    scanner.ctx = parser;
+
+    int scanning = 1;
+    while(scanning && !chain_broken(e)) {
+        char **argv;
+        ws_op op;
+        int argc = ws_next(&scanner, &argv, &op);
+        scanning = op != WS_END;
+        exec_alias(parser, e, argc, argv, op);
+        exec_run(parser, e, scanning);
+    }
+
+    exec_free(e);
+    return e->retval;
+}
+
+int lt_call(LT_Parser *parser, char *str) {
+    /*
+     * Parses the commands in string and executes the
+     * appropriate callbacks. Commands may be chained with
+     * ';', '&&' and '||', where a return value of 0 counts
+     * as success, and connected into pipelines with '|'.
+     * Each command is tokenized as the previous one finishes,
+     * in a single pass over the string, so variables set by
+     * one command can be used by the next
      */
     if(parser == NULL) return LT_CALL_FAILED;
+    // free the old commands
+    free_args(parser);
+    parser->command_id = LT_NO_COMMAND;
+    if(str == NULL) return LT_CALL_FAILED;
 
-    char *str = NULL;
+    LT_Exec e = {0};
+    return run_line(parser, str, &e);
+}
 
-    if(_matching_commands == NULL) {
-        char *tmp[] = {NULL};
-        matching_commands = tmp;
-    } else {
-        matching_commands = _matching_commands;
+static long long now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+LT_Result lt_dispatch(LT_Parser *parser, char *str) {
+    /*
+     * Runs str in the same way as lt_call, but reports what happened
+     * to the last command run separately from its return value,
+     * along with its ID and how long the call took
+     */
+    LT_Result r = {lt_failed, LT_CALL_FAILED, LT_NO_COMMAND, 0};
+    if(parser == NULL) return r;
+    long long start = now();
+    free_args(parser);
+    parser->command_id = LT_NO_COMMAND;
+    if(str != NULL) {
+        LT_Exec e = {0};
+        r.retval = run_line(parser, str, &e);
+        r.status = e.status;
+        r.id = parser->command_id;
     }
+    r.elapsed = now() - start;
+    return r;
+}
 
-    rl_attempted_completion_function = command_completion;
+int lt_add_alias(LT_Parser *parser, char *name, char *body) {
+    /*
+     * Defines name as an alias for body, which may hold several
+     * commands. body is tokenized now, with its variables expanded,
+     * and the words are spliced into the command line whenever the
+     * alias is used
+     */
+    assert(parser != NULL);
+    if(name == NULL || name[0] == '\0' || body == NULL) return 1;
+
+    LT_Alias *a = lt_calloc(1, sizeof(LT_Alias));
+    assert(a);
+    a->key = lt_strdup(name);
+    assert(a->key);
+    a->body = lt_strdup(body);
+    assert(a->body);
+    a->count = ws_chain(body, &a->argv, &a->ranges, var_value, parser);
+    if(a->count > 0) {
+        // aliases last, so drop the room the tokenizer left to grow
+        a->ranges = lt_realloc(a->ranges, sizeof(WS_Range) * a->count);
+        assert(a->ranges);
+    }
 
-    str = readline(parser->prompt);
-    if(str == NULL) {
-        free(str);
-        for(int i = 0; i < parser->argc; i++) {
-            free(parser->argv[i]);
+    lt_remove_alias(parser, name);
+    HASH_ADD_KEYPTR(hh, parser->aliases, a->key, strlen(a->key), a);
+    parser->generation++;
+    return 0;
+}
+
+void free_alias(LT_Alias *a) {
+    lt_free(a->key);
+    lt_free(a->body);
+    lt_free(a->argv);
+    lt_free(a->ranges);
+    lt_free(a);
+}
+
+int lt_remove_alias(LT_Parser *parser, char *name) {
+    assert(parser != NULL);
+    LT_Alias *a = find_alias(parser, name);
+    if(a == NULL) return 1;
+    HASH_DEL(parser->aliases, a);
+    free_alias(a);
+    parser->generation++;
+    return 0;
+}
+
+char *lt_get_alias(LT_Parser *parser, char *name) {
+    if(parser == NULL) return NULL;
+    LT_Alias *a = find_alias(parser, name);
+    return a ? a->body : NULL;
+}
+
+int lt_alias(int argc, char **argv, LT_Parser *parser) {
+    /*
+     * alias                list the aliases
+     * alias NAME=COMMAND   define an alias
+     * alias NAME           show an alias
+     */
+    assert(parser != NULL);
+    int retval = 0;
+    if(argc == 1) {
+        LT_Alias *a, *tmp;
+        HASH_ITER(hh, parser->aliases, a, tmp) {
+            lt_printf(parser, "alias %s=\"%s\"\n", a->key, a->body);
+        }
+    }
+    for(int i = 1; i < argc; i++) {
+        char *equals = strchr(argv[i], '=');
+        if(equals != NULL) {
+            *equals = '\0';
+            retval |= lt_add_alias(parser, argv[i], equals+1);
+            *equals = '=';
+        } else if(lt_get_alias(parser, argv[i]) != NULL) {
+            lt_printf(parser, "alias %s=\"%s\"\n", argv[i], lt_get_alias(parser, argv[i]));
+        } else {
+            lt_printf(parser, "alias: %s not found\n", argv[i]);
+            retval = 1;
+        }
+    }
+    return retval;
+}
+
+int lt_unalias(int argc, char **argv, LT_Parser *parser) {
+    assert(parser != NULL);
+    int retval = 0;
+    for(int i = 1; i < argc; i++) {
+        if(lt_remove_alias(parser, argv[i]) != 0) {
+            lt_printf(parser, "unalias: %s not found\n", argv[i]);
+            retval = 1;
         }
-        free(parser->argv);
-        parser->argv = NULL;
-        parser->argc = 0;
+    }
+    return retval;
+}
 
-        printf("\n");
-        free(str);
-        return LT_CALL_FAILED;
+int lt_set_var(LT_Parser *parser, char *name, char *value) {
+    /*
+     * Sets a variable, which is substituted for $name
+     * or ${name} in commands outside of single quotes
+     */
+    assert(parser != NULL);
+    if(name == NULL || value == NULL) return 1;
+    for(int i = 0; name[i] != '\0'; i++) {
+        if(!(isalnum((unsigned char)name[i]) || name[i] == '_') || (i == 0 && isdigit((unsigned char)name[i]))) return 1;
     }
-    if(parser->argv == NULL || strcmp(str, parser->argv[0]) != 0) {
-        add_history(str);
+    if(name[0] == '\0') return 1;
+
+    char *copy = lt_strdup(value);
+    assert(copy);
+    LT_Var *v = NULL;
+    HASH_FIND_STR(parser->vars, name, v);
+    if(v != NULL) {
+        lt_free(v->value);
+        v->value = copy;
+        return 0;
     }
+    v = lt_malloc(sizeof(LT_Var));
+    assert(v);
+    v->key = lt_strdup(name);
+    assert(v->key);
+    v->value = copy;
+    HASH_ADD_KEYPTR(hh, parser->vars, v->key, strlen(v->key), v);
+    return 0;
+}
 
+char *lt_get_var(LT_Parser *parser, char *name) {
+    if(parser == NULL || name == NULL) return NULL;
+    LT_Var *v = NULL;
+    HASH_FIND_STR(parser->vars, name, v);
+    return v ? v->value : NULL;
+}
+
+void free_var(LT_Var *v) {
+    lt_free(v->key);
+    lt_free(v->value);
+    lt_free(v);
+}
+
+int lt_unset_var(LT_Parser *parser, char *name) {
+    assert(parser != NULL);
+    if(name == NULL) return 1;
+    LT_Var *v = NULL;
+    HASH_FIND_STR(parser->vars, name, v);
+    if(v == NULL) return 1;
+    HASH_DEL(parser->vars, v);
+    free_var(v);
+    return 0;
+}
+
+int lt_set(int argc, char **argv, LT_Parser *parser) {
+    /*
+     * set                  list the variables
+     * set NAME [VALUE]...  set a variable to the values joined by spaces
+     */
+    assert(parser != NULL);
+    if(argc == 1) {
+        LT_Var *v, *tmp;
+        HASH_ITER(hh, parser->vars, v, tmp) {
+            lt_printf(parser, "%s=%s\n", v->key, v->value);
+        }
+        return 0;
+    }
+    size_t len = 1;
+    for(int i = 2; i < argc; i++) len += strlen(argv[i]) + 1;
+    char *value = lt_malloc(len);
+    assert(value);
+    value[0] = '\0';
+    for(int i = 2; i < argc; i++) {
+        if(i > 2) strcat(value, " ");
+        strcat(value, argv[i]);
+    }
+    int retval = lt_set_var(parser, argv[1], value);
+    lt_free(value);
+    if(retval != 0) lt_printf(parser, "set: '%s' is not a valid variable name\n", argv[1]);
+    return retval;
+}
+
+int lt_unset(int argc, char **argv, LT_Parser *parser) {
+    assert(parser != NULL);
+    int retval = 0;
+    for(int i = 1; i < argc; i++) {
+        retval |= lt_unset_var(parser, argv[i]);
+    }
+    return retval;
+}
+
+static char *read_input(LT_Parser *parser, char **_matching_commands) {
+    /*
+     * Reads a line with readline, adding it to the history.
+     * Returns NULL at the end of input
+     */
+    char *str = NULL;
+
+    // without a list of matches, complete all the commands shown in help
+    matching_commands = _matching_commands;
+    completing_parser = parser;
+    completion_reset();
+
+    rl_attempted_completion_function = command_completion;
+
+    history_sync(parser);
+    str = readline(parser->prompt);
     matching_commands = NULL;
+    completing_parser = NULL;
+    if(str == NULL) {
+        free_args(parser);
+        parser->command_id = LT_NO_COMMAND;
+
+        lt_printf(parser, "\n");
+        lt_flush(parser);
+        return NULL;
+    }
+    lt_history_add(parser, str);
+    return str;
+}
+
+int lt_input(LT_Parser *parser, char **_matching_commands) {
+    /*
+     * Reads from stdin and executes lt_call
+     */
+    if(parser == NULL) return LT_CALL_FAILED;
+
+    char *str = read_input(parser, _matching_commands);
+    if(str == NULL) return LT_CALL_FAILED;
 
     int retval = lt_call(parser, str);
     free(str);
     return retval;
 }
 
-int lt_cleanup(LT_Parser *parser) {
+LT_Result lt_dispatch_input(LT_Parser *parser, char **_matching_commands) {
     /*
-     * Free a parser
+     * Reads from stdin and executes lt_dispatch. The status
+     * is lt_end_of_input once there is nothing more to read
      */
-    if(parser == NULL) return 0;
+    LT_Result r = {lt_failed, LT_CALL_FAILED, LT_NO_COMMAND, 0};
+    if(parser == NULL) return r;
 
-    for(int i = 0; i < parser->argc; i++) {
-        free(parser->argv[i]);
+    char *str = read_input(parser, _matching_commands);
+    if(str == NULL) {
+        r.status = lt_end_of_input;
+        return r;
     }
 
-    int count = 0;
-    int total = HASH_COUNT(parser->commands);
-    LT_Command *tmp, *s;
-    HASH_ITER(hh, parser->commands, s, tmp) {
-        HASH_DEL(parser->commands, s);
-        free(s->help);
-        free(s->help_extended);
-        free(s->key);
-        free(s);
-        count++;
+    r = lt_dispatch(parser, str);
+    free(str);
+    return r;
+}
+
+static void clear_session(LT_Parser *parser) {
+    // what running commands leaves behind, as opposed to the commands themselves
+    free_args(parser);
+    parser->command_id = LT_NO_COMMAND;
+    LT_Alias *a, *a_tmp;
+    HASH_ITER(hh, parser->aliases, a, a_tmp) {
+        HASH_DEL(parser->aliases, a);
+        free_alias(a);
     }
+    LT_Var *v, *v_tmp;
+    HASH_ITER(hh, parser->vars, v, v_tmp) {
+        HASH_DEL(parser->vars, v);
+        free_var(v);
+    }
+    parser->generation++;
+}
+
+int lt_reset(LT_Parser *parser, int clear_commands) {
+    /*
+     * Returns a parser to how it was before anything ran: the last
+     * arguments, aliases and variables are dropped, buffered output is
+     * written and output captured in memory is discarded. With
+     * clear_commands the commands go too, all at once, leaving only
+     * help and exit. The prompt, verbosity, history and where help is
+     * loaded from are kept. Returns 0 on success
+     */
+    if(parser == NULL) return 1;
+    clear_session(parser);
+    output_flush(parser->output);
+    lt_output_clear(parser);
+    if(!clear_commands) return 0;
+
+    // uthash makes a new table for the first command added to an empty
+    // hash, so the old one goes rather than being emptied in place
+    HASH_CLEAR(hh, parser->commands);
+    view_clear(parser);
+    help_index_free(parser);
+    pool_reset(parser);
+    // IDs carry on from where they were, so old ones stay stale
+    add_defaults(parser);
+    return 0;
+}
+
+int lt_cleanup(LT_Parser *parser) {
+    /*
+     * Free a parser
+     */
+    if(parser == NULL) return 0;
 
-    free(parser);
+    lt_history_close(parser);
+    clear_session(parser);
+    // the commands are all in the pool, which goes in one piece
+    HASH_CLEAR(hh, parser->commands);
+
+    help_index_free(parser);
+    help_catalog_close(parser);
+    view_free(parser);
+    pool_free(parser);
+    output_flush(parser->output);
+    output_destroy(parser->output);
+    lt_free(parser->sorted);
+    lt_free(parser->masks);
+    lt_free(parser->lengths);
+    lt_free(parser);
 
     return 0;
 }
 
+static size_t words_size(int argc, char **argv) {
+    // the size of a word list made by the tokenizer
+    size_t size = sizeof(char*) * (argc + 1);
+    for(int i = 0; i < argc; i++) size += strlen(argv[i]) + 1;
+    return size;
+}
+
+LT_Memory lt_memory(LT_Parser *parser) {
+    /*
+     * Adds up the memory a parser holds, by what it is used for.
+     * Hash tables count their buckets as well as their items
+     */
+    LT_Memory m = {0};
+    if(parser == NULL) return m;
+    memory_add(&m, lt_mem_other, sizeof(LT_Parser));
+
+    MEMORY_TABLE(&m, lt_mem_commands, hh, parser->commands);
+    if(parser->sorted) {
+        size_t count = parser->nsorted ? parser->nsorted : 1;
+        memory_add(&m, lt_mem_commands, sizeof(LT_Command*) * count);
+        memory_add(&m, lt_mem_commands, sizeof(unsigned long long) * count);
+        memory_add(&m, lt_mem_commands, sizeof(int) * count);
+    }
+    for(int view = 0; view < LT_VIEWS; view++) {
+        if(parser->views[view].cap) memory_add(&m, lt_mem_commands, sizeof(LT_Command*) * parser->views[view].cap);
+    }
+    help_memory(parser, &m);
+
+    if(parser->argv) memory_add(&m, lt_mem_argv, words_size(parser->argc, parser->argv));
+    completion_memory(parser, &m);
+    history_memory(parser, &m);
+
+    MEMORY_TABLE(&m, lt_mem_other, hh, parser->aliases);
+    LT_Alias *a, *a_tmp;
+    HASH_ITER(hh, parser->aliases, a, a_tmp) {
+        memory_add(&m, lt_mem_other, sizeof(LT_Alias));
+        memory_add(&m, lt_mem_other, strlen(a->key) + 1);
+        memory_add(&m, lt_mem_other, strlen(a->body) + 1);
+        size_t words = 0;
+        for(int i = 0; i < a->count; i++) words += words_size(a->ranges[i].argc, a->argv + a->ranges[i].start);
+        if(a->argv) memory_add(&m, lt_mem_other, words ? words : sizeof(char*));
+        if(a->ranges) memory_add(&m, lt_mem_other, sizeof(WS_Range) * a->count);
+    }
+    MEMORY_TABLE(&m, lt_mem_other, hh, parser->vars);
+    LT_Var *v, *v_tmp;
+    HASH_ITER(hh, parser->vars, v, v_tmp) {
+        memory_add(&m, lt_mem_other, sizeof(LT_Var));
+        memory_add(&m, lt_mem_other, strlen(v->key) + 1);
+        memory_add(&m, lt_mem_other, strlen(v->value) + 1);
+    }
+    output_memory(parser->output, &m);
+    return m;
+}
+
 void lt_print_parser(LT_Parser *parser) {
     if(parser == NULL) {
         printf("parser: NULL\n");
@@ -306,10 +944,23 @@ void lt_print_parser(LT_Parser *parser) {
     int argc = parser->argc;
     char *str = parser->argv ? parser->argv[0] : NULL;
     lt_verbosity v = parser->verbosity;
-    printf("parser (%p)\n\titems: %d\n\targc: %d\n\targv[0]: '%s'\n\tstate: %d\n", ptr, items, argc, str, v);
-    printf("\tItems are:\n");
+    lt_printf(parser, "parser (%p)\n\titems: %d\n\targc: %d\n\targv[0]: '%s'\n\tstate: %d\n", ptr, items, argc, str, v);
+    lt_printf(parser, "\tItems are:\n");
     LT_Command *s, *tmp;
     HASH_ITER(hh, parser->commands, s, tmp) {
-        printf("\t\t'%s' '%s' '%s' (%p)\n", s->key, s->help, s->help_extended, s);
+        lt_printf(parser, "\t\t%d '%s' '%s' '%s' (%p)\n", s->id, s->key, s->help, s->help_extended, s);
+    }
+    if(parser->verbosity >= lt_verbose) {
+        static const char *names[] = {"commands", "help", "argv", "completion", "history", "other"};
+        LT_Memory m = lt_memory(parser);
+        size_t bytes = 0, allocations = 0;
+        lt_printf(parser, "\tMemory is:\n");
+        for(int i = 0; i < lt_mem_categories; i++) {
+            lt_printf(parser, "\t\t%-10s %zu bytes in %zu allocations\n", names[i], m.bytes[i], m.allocations[i]);
+            bytes += m.bytes[i];
+            allocations += m.allocations[i];
+        }
+        lt_printf(parser, "\t\t%-10s %zu bytes in %zu allocations\n", "total", bytes, allocations);
     }
+    lt_flush(parser);
 }
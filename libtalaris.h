@@ -29,10 +29,22 @@
 #ifndef __LTALARIS
 #define __LTALARIS
 
+#include <sys/types.h>
+
+void *lt_malloc(size_t);
+void *lt_calloc(size_t, size_t);
+void *lt_realloc(void*, size_t);
+void lt_free(void*);
+char *lt_strdup(const char*);
+char *lt_strndup(const char*, size_t);
+
 #include "uthash.h"
 
 #define LT_CALL_FAILED -99
 #define LT_COMMAND_NOT_FOUND -98
+#define LT_BAD_ARGUMENTS -97
+
+#define LT_NO_COMMAND -1 /* command ID when no command ran */
 
 #define LT_HIDE 00
 #define LT_HELP 01
@@ -45,6 +57,18 @@
 #define LT_IS_EXEC(a)(a & LT_EXEC)
 #define LT_IS_SHOW(a)(a & (LT_HELP | LT_SPEC))
 
+#define LT_ARG_OPTIONAL 01 /* the argument may be left out */
+#define LT_ARG_REPEAT 02   /* the argument takes all remaining arguments */
+
+#define LT_OPT_ARG 01 /* the option takes an argument, as -n 5, -n5, --limit 5 or --limit=5 */
+
+#define LT_SUGGEST_MAX 3 /* suggestions printed for an unknown command */
+#define LT_MAX_ARGS 64 /* arguments converted for a command with a schema */
+#define LT_MAX_OPTIONS 32 /* options a command may declare */
+#define LT_ALIAS_DEPTH 16 /* aliases expanding to other aliases */
+#define LT_STREAM_CAPACITY 16 /* chunks buffered between pipeline stages */
+#define LT_HISTORY_MAX (1 << 20) /* default bytes of history kept in memory */
+
 typedef char lt_state;
 /*
  * 1st bit: show in help
@@ -61,35 +85,261 @@ typedef enum lt_verbosity {
 
 typedef struct lt_parser LT_Parser;
 
+typedef struct lt_stream LT_Stream;
+typedef struct lt_output LT_Output;
+typedef struct lt_history LT_History;
+typedef struct lt_term LT_Term;
+typedef struct lt_listing LT_Listing;
+typedef struct lt_catalog LT_Catalog;
+typedef struct lt_pool LT_Pool;
+
+/* receives flushed output when a parser's output is sent to a writer */
+typedef int(*lt_writer)(const char*, size_t, void*);
+
 typedef int(*lt_callback)(int, char**, LT_Parser*);
 
+/* allocator hooks for lt_set_allocator, each passed its context last */
+typedef void *(*lt_malloc_hook)(size_t, void*);
+typedef void *(*lt_realloc_hook)(void*, size_t, void*);
+typedef void (*lt_free_hook)(void*, void*);
+
+/* returns the help (or extended help) of a command added without any */
+typedef const char *(*lt_help_loader)(LT_Parser*, const char*, int, void*);
+
+typedef enum lt_type {
+    lt_string,
+    lt_int,
+    lt_float,
+    lt_bool
+} lt_type;
+
+/* one entry of a command's argument schema, in arrays ending with {0} */
+typedef struct lt_arg {
+    char *name;
+    lt_type type;
+    int flags;
+} LT_Arg;
+
+/* an argument converted according to the schema */
+typedef struct lt_value {
+    lt_type type;
+    char *text;     /* the argument as it was entered */
+    union {
+        long i;
+        double f;
+        int b;
+    };
+} LT_Value;
+
+/* one option a command accepts, in arrays ending with {0} */
+typedef struct lt_option {
+    char short_name;    /* '\0' if the option has no short form */
+    char *long_name;    /* NULL if the option has no long form */
+    int flags;
+} LT_Option;
+
+/* what was given for an option, in the same order as the command's options */
+typedef struct lt_opt_value {
+    int count;  /* times the option was given */
+    char *arg;  /* its last argument */
+} LT_Opt_Value;
+
+/*
+ * Completes an argument of a command. argv holds the words before the
+ * one being completed, starting with the command name. Called with
+ * state 0 and then increasing until it returns NULL, returning one
+ * candidate starting with text each time. The candidate is copied
+ */
+typedef const char *(*lt_completer)(int, char**, const char*, int, LT_Parser*);
+
+/*
+ * Callback for commands used in pipelines: the input and output
+ * streams connect the command to its neighbours in the pipeline.
+ * in is NULL for the first command, out is NULL for the last
+ */
+typedef int(*lt_stream_callback)(int, char**, LT_Parser*, LT_Stream*, LT_Stream*);
+
 typedef struct lt_command {
     char *key;
     char *help;
     char *help_extended;
-    lt_state state;
+    lt_state state;     /* changed with lt_set_state once the command is added */
     lt_callback callback;
+    lt_stream_callback stream;
+    LT_Arg *args;
+    LT_Option *options;
+    lt_completer complete;
     UT_hash_handle hh;
+    int id;
+    int min_args, max_args;
+    struct lt_opt_table *opt_table;     /* options compiled for lookup */
 } LT_Command;
 
+typedef struct lt_alias {
+    char *key;
+    char *body;
+    char **argv;            /* body tokenized when the alias was defined */
+    struct ws_range *ranges;
+    int count;              /* number of commands in body */
+    UT_hash_handle hh;
+} LT_Alias;
+
+typedef struct lt_var {
+    char *key;
+    char *value;
+    UT_hash_handle hh;
+} LT_Var;
+
+typedef enum lt_status {
+    lt_ok,              /* the callback ran, and retval is what it returned */
+    lt_not_found,
+    lt_ambiguous,       /* an abbreviation matched more than one command */
+    lt_bad_arguments,
+    lt_no_callback,
+    lt_failed,          /* nothing could be run, eg the parser was NULL */
+    lt_end_of_input
+} lt_status;
+
+/* the command a call ended with and what happened to it */
+typedef struct lt_result {
+    lt_status status;
+    int retval;
+    int id;
+    long long elapsed;  /* nanoseconds taken by the whole call */
+} LT_Result;
+
+/* what the memory held by a parser is used for */
+typedef enum lt_mem_category {
+    lt_mem_commands,    /* commands, their arguments and options, and the lists of them */
+    lt_mem_help,        /* help text, the help index and listing */
+    lt_mem_argv,        /* the words of the last call */
+    lt_mem_completion,
+    lt_mem_history,
+    lt_mem_other,       /* the parser itself, aliases, variables and output */
+    lt_mem_categories
+} lt_mem_category;
+
+/* bytes and allocations held by a parser, by category */
+typedef struct lt_memory {
+    size_t bytes[lt_mem_categories];
+    size_t allocations[lt_mem_categories];
+} LT_Memory;
+
+/* lists of the commands shown in help, and those shown in either kind of help */
+enum {LT_VIEW_HELP, LT_VIEW_SHOW, LT_VIEWS};
+
+/* the commands in one of a parser's views, in order of name */
+typedef struct lt_view {
+    LT_Command **commands;
+    int count, cap;
+    int sorted;             /* the commands before this are in order, the rest were just added */
+    unsigned long version;  /* changes whenever the list does */
+} LT_View;
+
 typedef struct lt_parser {
     LT_Command *commands;
+    LT_Alias *aliases;
+    LT_Var *vars;
     lt_verbosity verbosity;
     lt_callback unfound;
     int argc;
     char **argv;
+    int command_id;     /* ID of the command argv was passed to */
+    int next_id;
     char *prompt;
+    LT_Output *output;
+    unsigned long generation;   /* changes whenever commands or aliases are added or removed */
+    int abbreviate;     /* run a command given a unique prefix of its name */
+    LT_History *history;
+
+    /* commands sorted by name, rebuilt when the generation changes */
+    LT_Command **sorted;
+    unsigned long long *masks;  /* the letters in each name, for lt_suggest */
+    int *lengths;
+    int nsorted;
+    unsigned long sorted_generation;
+
+    LT_Term *help_terms;    /* words of the help text, for lt_search_help */
+    LT_View views[LT_VIEWS];    /* kept up to date as commands are added or change state */
+    LT_Listing *listing;    /* the lines help lists */
+    LT_Catalog *catalog;    /* help of commands added without it, see lt_help_catalog */
+    lt_help_loader help_loader;
+    void *help_loader_ctx;
+    LT_Pool *pool;          /* names and help of the commands, each stored once */
+    int help_page;          /* if set, help flushes its list after this many lines at a time */
 } LT_Parser;
 
+void lt_set_allocator(lt_malloc_hook, lt_realloc_hook, lt_free_hook, void*);
 LT_Parser *lt_create_parser(void);
 int lt_add_commands(LT_Parser*, LT_Command*);
 int lt_add_command(LT_Parser*, char*, char*, char*, lt_callback);
 int lt_remove_command(LT_Parser*, char*);
+int lt_set_args(LT_Parser*, char*, LT_Arg*);
+LT_Value *lt_args(LT_Parser*, int*);
+long lt_arg_int(LT_Parser*, int);
+double lt_arg_float(LT_Parser*, int);
+char *lt_arg_string(LT_Parser*, int);
+int lt_set_options(LT_Parser*, char*, LT_Option*);
+int lt_set_completer(LT_Parser*, char*, lt_completer);
+int lt_set_state(LT_Parser*, char*, lt_state);
+LT_Opt_Value *lt_opts(LT_Parser*, int*);
+int lt_opt_count(LT_Parser*, const char*);
+char *lt_opt_arg(LT_Parser*, const char*);
 LT_Command* lt_get_command(LT_Parser*, char*);
+int lt_command_id(LT_Parser*, char*);
+int lt_suggest(LT_Parser*, const char*, char**, int);
+int lt_search_help(LT_Parser*, const char*, LT_Command**, int);
+int lt_add_alias(LT_Parser*, char*, char*);
+int lt_remove_alias(LT_Parser*, char*);
+char *lt_get_alias(LT_Parser*, char*);
+int lt_set_var(LT_Parser*, char*, char*);
+char *lt_get_var(LT_Parser*, char*);
+int lt_unset_var(LT_Parser*, char*);
 int lt_call(LT_Parser*, char*);
+LT_Result lt_dispatch(LT_Parser*, char*);
 int lt_input(LT_Parser*, char **);
+int lt_history_open(LT_Parser*, const char*, size_t);
+void lt_history_add(LT_Parser*, const char*);
+int lt_history_count(LT_Parser*);
+int lt_history_search(LT_Parser*, const char*, const char**, int);
+void lt_history_close(LT_Parser*);
+LT_Result lt_dispatch_input(LT_Parser*, char**);
+int lt_run_script(LT_Parser*, const char*);
+int lt_compile_script(LT_Parser*, const char*, const char*);
+int lt_run_compiled(LT_Parser*, const char*);
 int lt_cleanup(LT_Parser*);
+int lt_reset(LT_Parser*, int);
+LT_Memory lt_memory(LT_Parser*);
 void lt_print_parser(LT_Parser*);
 int lt_help(int, char**, LT_Parser*);
+int lt_apropos(int, char**, LT_Parser*);
+int lt_help_catalog(LT_Parser*, const char*);
+void lt_set_help_loader(LT_Parser*, lt_help_loader, void*);
+int lt_alias(int, char**, LT_Parser*);
+int lt_unalias(int, char**, LT_Parser*);
+int lt_set(int, char**, LT_Parser*);
+int lt_unset(int, char**, LT_Parser*);
+const char *lt_complete_commands(int, char**, const char*, int, LT_Parser*);
+const char *lt_complete_vars(int, char**, const char*, int, LT_Parser*);
+const char *lt_complete_paths(int, char**, const char*, int, LT_Parser*);
+
+int lt_printf(LT_Parser*, const char*, ...);
+int lt_write(LT_Parser*, const char*, size_t);
+int lt_flush(LT_Parser*);
+void lt_output_to_fd(LT_Parser*, int);
+void lt_output_to_memory(LT_Parser*);
+void lt_output_to_writer(LT_Parser*, lt_writer, void*);
+char *lt_output_data(LT_Parser*, size_t*);
+void lt_output_clear(LT_Parser*);
+
+LT_Stream *lt_stream_create(int);
+void lt_stream_destroy(LT_Stream*);
+int lt_stream_push(LT_Stream*, char*, size_t);
+int lt_stream_write(LT_Stream*, const char*, size_t);
+int lt_stream_printf(LT_Stream*, const char*, ...);
+char *lt_stream_pull(LT_Stream*, size_t*);
+ssize_t lt_stream_getline(LT_Stream*, char**, size_t*);
+void lt_stream_close(LT_Stream*);
+void lt_stream_abandon(LT_Stream*);
 
 #endif
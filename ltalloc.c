@@ -0,0 +1,95 @@
+#include "ltalloc.h"
+#include "libtalaris.h"
+#include "ltcall.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Every allocation libtalaris makes goes through these, including the
+ * tables uthash builds. Strings exchanged with readline are the
+ * exception, since readline allocates and frees them with malloc
+ */
+
+static void *system_malloc(size_t size, void *ctx) {
+    return malloc(size);
+}
+
+static void *system_realloc(void *ptr, size_t size, void *ctx) {
+    return realloc(ptr, size);
+}
+
+static void system_free(void *ptr, void *ctx) {
+    free(ptr);
+}
+
+static struct {
+    lt_malloc_hook malloc;
+    lt_realloc_hook realloc;
+    lt_free_hook free;
+    void *ctx;
+} allocator = {system_malloc, system_realloc, system_free, NULL};
+
+void lt_set_allocator(lt_malloc_hook malloc_hook, lt_realloc_hook realloc_hook, lt_free_hook free_hook, void *ctx) {
+    /*
+     * Sends libtalaris's allocations to the given functions, or back
+     * to the C library if any of them is NULL. Memory is always freed
+     * with the functions set at the time, so they must not change once
+     * anything has been allocated: call this before any parser, stream
+     * or output is created
+     */
+    if(malloc_hook == NULL || realloc_hook == NULL || free_hook == NULL) {
+        allocator.malloc = system_malloc;
+        allocator.realloc = system_realloc;
+        allocator.free = system_free;
+        allocator.ctx = NULL;
+        return;
+    }
+    allocator.malloc = malloc_hook;
+    allocator.realloc = realloc_hook;
+    allocator.free = free_hook;
+    allocator.ctx = ctx;
+}
+
+void *lt_malloc(size_t size) {
+    return allocator.malloc(size, allocator.ctx);
+}
+
+void *lt_calloc(size_t count, size_t size) {
+    if(size != 0 && count > (size_t)-1 / size) return NULL;
+    void *ptr = allocator.malloc(count * size, allocator.ctx);
+    if(ptr != NULL) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void *lt_realloc(void *ptr, size_t size) {
+    return allocator.realloc(ptr, size, allocator.ctx);
+}
+
+void lt_free(void *ptr) {
+    if(ptr != NULL) allocator.free(ptr, allocator.ctx);
+}
+
+char *lt_strdup(const char *str) {
+    return lt_strndup(str, strlen(str));
+}
+
+char *lt_strndup(const char *str, size_t max) {
+    size_t len = strnlen(str, max);
+    char *copy = allocator.malloc(len + 1, allocator.ctx);
+    if(copy == NULL) return NULL;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void memory_add(LT_Memory *m, lt_mem_category category, size_t bytes) {
+    // one allocation of bytes
+    m->bytes[category] += bytes;
+    m->allocations[category]++;
+}
+
+void memory_items(LT_Memory *m, lt_mem_category category, size_t count, size_t size) {
+    // count allocations of size bytes each
+    m->bytes[category] += count * size;
+    m->allocations[category] += count;
+}
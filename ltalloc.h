@@ -0,0 +1,15 @@
+#ifndef __LTALLOC
+#define __LTALLOC
+#include <stddef.h>
+
+/*
+ * Included first by the library's own files, before uthash.h, so the
+ * hash tables in a parser are allocated like everything else. Programs
+ * including libtalaris.h keep uthash's own allocator
+ */
+void *lt_malloc(size_t);
+void lt_free(void*);
+#define uthash_malloc(sz) lt_malloc(sz)
+#define uthash_free(ptr, sz) lt_free(ptr)
+
+#endif
@@ -0,0 +1,346 @@
+#include "ltalloc.h"
+#include "libtalaris.h"
+#include "ltcall.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <errno.h>
+#include <strings.h>
+#include <ctype.h>
+
+static __thread LT_Context *current_context = NULL;
+
+LT_Context *context_swap(LT_Context *context) {
+    LT_Context *old = current_context;
+    current_context = context;
+    return old;
+}
+
+int compile_args(LT_Parser *parser, LT_Command *c, LT_Arg *args) {
+    /*
+     * Copies a schema into the parser's pool for c and works out how
+     * many arguments it accepts. Optional arguments must come after
+     * the others and only the last argument may repeat. Returns 0 on
+     * success
+     */
+    int count = 0, min = 0, max = 0;
+    for(; args != NULL && args[count].name != NULL; count++) {
+        int flags = args[count].flags;
+        if(!(flags & LT_ARG_OPTIONAL) && min != count) return 1;
+        if(count > 0 && (args[count-1].flags & LT_ARG_REPEAT)) return 1;
+        if(!(flags & LT_ARG_OPTIONAL)) min++;
+        max = flags & LT_ARG_REPEAT ? LT_MAX_ARGS : max + 1;
+    }
+    if(max > LT_MAX_ARGS) return 1;
+
+    clear_schema(parser, c);
+    if(count == 0) return 0;
+    c->args = pool_calloc(parser, count + 1, sizeof(LT_Arg), lt_mem_commands);
+    for(int i = 0; i < count; i++) {
+        c->args[i] = args[i];
+        c->args[i].name = pool_intern(parser, args[i].name);
+    }
+    c->min_args = min;
+    c->max_args = max;
+    return 0;
+}
+
+void clear_schema(LT_Parser *parser, LT_Command *c) {
+    // gives the schema back to the pool
+    if(c->args != NULL) {
+        int count = 0;
+        for(; c->args[count].name != NULL; count++) pool_drop(parser, c->args[count].name);
+        pool_release(parser, c->args, count + 1, sizeof(LT_Arg), lt_mem_commands);
+    }
+    c->args = NULL;
+    c->min_args = c->max_args = 0;
+}
+
+static int convert(LT_Value *v, lt_type type, char *text) {
+    char *end;
+    v->type = type;
+    v->text = text;
+    // words have no number, so lt_arg_int and lt_arg_float give 0 for them
+    v->i = 0;
+    errno = 0;
+    switch(type) {
+        case lt_int:
+            v->i = strtol(text, &end, 10);
+            return end != text && *end == '\0' && errno == 0;
+        case lt_float:
+            v->f = strtod(text, &end);
+            return end != text && *end == '\0' && errno == 0;
+        case lt_bool:
+            if(!strcasecmp(text, "true") || !strcasecmp(text, "yes") || !strcasecmp(text, "on") || !strcmp(text, "1")) {
+                v->b = 1;
+                return 1;
+            }
+            v->b = 0;
+            return !strcasecmp(text, "false") || !strcasecmp(text, "no") || !strcasecmp(text, "off") || !strcmp(text, "0");
+        default:
+            return 1;
+    }
+}
+
+int convert_args(LT_Parser *parser, LT_Command *c, int argc, char **argv, LT_Value *values) {
+    /*
+     * Checks argv[1..] against the command's schema, filling in values.
+     * Prints what was wrong and returns -1 if the arguments don't fit,
+     * otherwise returns the number of values
+     */
+    static const char *type_names[] = {"a word", "an integer", "a number", "true or false"};
+    int count = argc - 1;
+    if(count < c->min_args || count > c->max_args) {
+        lt_printf(parser, "%s: expected %s%d argument%s but got %d\n", c->key,
+                c->min_args == c->max_args ? "" : count < c->min_args ? "at least " : "at most ",
+                count < c->min_args ? c->min_args : c->max_args,
+                (count < c->min_args ? c->min_args : c->max_args) == 1 ? "" : "s", count);
+        print_usage(parser, c, "");
+        return -1;
+    }
+    LT_Arg *arg = c->args;
+    for(int i = 0; i < count; i++) {
+        if(!convert(&values[i], arg->type, argv[i+1])) {
+            lt_printf(parser, "%s: %s must be %s, not '%s'\n", c->key, arg->name, type_names[arg->type], argv[i+1]);
+            return -1;
+        }
+        if(!(arg->flags & LT_ARG_REPEAT)) arg++;
+    }
+    return count;
+}
+
+int lt_set_args(LT_Parser *parser, char *command, LT_Arg *args) {
+    /*
+     * Gives a command an argument schema, or removes it if args is NULL.
+     * Returns 0 on success
+     */
+    LT_Command *c = lt_get_command(parser, command);
+    if(c == NULL) return 1;
+    if(args == NULL) {
+        clear_schema(parser, c);
+        return 0;
+    }
+    return compile_args(parser, c, args);
+}
+
+LT_Value *lt_args(LT_Parser *parser, int *count) {
+    /*
+     * Returns the converted arguments of the running command,
+     * or NULL if it has no schema
+     */
+    LT_Context *context = current_context;
+    if(count) *count = context ? context->count : 0;
+    return context ? context->values : NULL;
+}
+
+static LT_Value *value_at(int i) {
+    LT_Context *context = current_context;
+    if(context == NULL || context->values == NULL || i < 0 || i >= context->count) return NULL;
+    return &context->values[i];
+}
+
+long lt_arg_int(LT_Parser *parser, int i) {
+    LT_Value *v = value_at(i);
+    if(v == NULL) return 0;
+    return v->type == lt_float ? (long)v->f : v->type == lt_bool ? v->b : v->i;
+}
+
+double lt_arg_float(LT_Parser *parser, int i) {
+    LT_Value *v = value_at(i);
+    if(v == NULL) return 0;
+    return v->type == lt_float ? v->f : v->type == lt_bool ? v->b : v->i;
+}
+
+char *lt_arg_string(LT_Parser *parser, int i) {
+    LT_Value *v = value_at(i);
+    return v ? v->text : NULL;
+}
+
+static int find_long(LT_Opt_Table *t, const char *name, int len) {
+    /*
+     * Returns the index of the option called name, or -1. A command
+     * has at most LT_MAX_OPTIONS options, so looking through them
+     * costs no more than hashing the name would
+     */
+    for(int i = 0; i < t->count; i++) {
+        char *long_name = t->options[i].long_name;
+        if(long_name != NULL && strncmp(long_name, name, len) == 0 && long_name[len] == '\0') return i;
+    }
+    return -1;
+}
+
+static void free_table(LT_Parser *parser, LT_Opt_Table *t) {
+    for(int i = 0; i < t->count; i++) pool_drop(parser, t->options[i].long_name);
+    pool_release(parser, t->options, t->count + 1, sizeof(LT_Option), lt_mem_commands);
+    pool_release(parser, t, 1, sizeof(LT_Opt_Table), lt_mem_commands);
+}
+
+static int fill_table(LT_Parser *parser, LT_Opt_Table *t, LT_Option *options) {
+    for(int i = 0; i < t->count; i++) {
+        unsigned char ch = options[i].short_name;
+        if(ch != '\0') {
+            if(ch >= 128 || !isgraph(ch) || ch == '-' || t->shorts[ch] != -1) return 1;
+            t->shorts[ch] = i;
+        }
+        char *name = options[i].long_name;
+        if(name != NULL) {
+            if(name[0] == '\0' || strchr(name, '=') != NULL) return 1;
+            if(find_long(t, name, strlen(name)) != -1) return 1;
+        }
+        t->options[i] = options[i];
+        t->options[i].long_name = pool_intern(parser, name);
+    }
+    return 0;
+}
+
+void clear_options(LT_Parser *parser, LT_Command *c) {
+    if(c->opt_table != NULL) free_table(parser, c->opt_table);
+    c->opt_table = NULL;
+    c->options = NULL;
+}
+
+int compile_options(LT_Parser *parser, LT_Command *c, LT_Option *options) {
+    /*
+     * Builds the lookup table for a command's options in the parser's
+     * pool: short options index a table directly and long options are
+     * looked up by name. Options must have a name, and no name may be
+     * used twice. Returns 0 on success
+     */
+    int count = 0;
+    while(options != NULL && (options[count].short_name != '\0' || options[count].long_name != NULL)) count++;
+    if(count > LT_MAX_OPTIONS) return 1;
+
+    if(count == 0) {
+        clear_options(parser, c);
+        return 0;
+    }
+    LT_Opt_Table *t = pool_calloc(parser, 1, sizeof(LT_Opt_Table), lt_mem_commands);
+    memset(t->shorts, -1, sizeof(t->shorts));
+    // the options not yet copied have no long name to match, and the
+    // last entry is left as the {0} that ends the command's options
+    t->options = pool_calloc(parser, count + 1, sizeof(LT_Option), lt_mem_commands);
+    t->count = count;
+    if(fill_table(parser, t, options) != 0) {
+        free_table(parser, t);
+        return 1;
+    }
+    clear_options(parser, c);
+    c->opt_table = t;
+    c->options = t->options;
+    return 0;
+}
+
+static int bad_option(LT_Parser *parser, LT_Command *c, const char *problem, const char *dashes, const char *name, int len) {
+    lt_printf(parser, "%s: %s '%s%.*s'\n", c->key, problem, dashes, len, name);
+    print_usage(parser, c, "");
+    return -1;
+}
+
+int parse_options(LT_Parser *parser, LT_Command *c, int argc, char **argv, char **positional, LT_Opt_Value *values) {
+    /*
+     * Sorts argv into options, recorded in values, and positional
+     * arguments, copied to positional after argv[0]. Options may come
+     * anywhere before a "--". A word such as -5 is positional unless
+     * the command has a short option for the digit. Returns the
+     * number of words in positional, or -1 if an option was wrong
+     */
+    LT_Opt_Table *t = c->opt_table;
+    memset(values, 0, sizeof(LT_Opt_Value) * t->count);
+    int count = 0;
+    positional[count++] = argv[0];
+    int done = 0;
+    for(int i = 1; i < argc; i++) {
+        char *word = argv[i];
+        unsigned char first = word[0] == '-' ? word[1] : '\0';
+        if(done || first == '\0' || (isdigit(first) && t->shorts[first] == -1)) {
+            positional[count++] = word;
+            continue;
+        }
+        if(first == '-' && word[2] == '\0') {
+            done = 1;
+            continue;
+        }
+
+        if(first == '-') {
+            char *name = word + 2;
+            char *equals = strchr(name, '=');
+            int len = equals ? equals - name : (int)strlen(name);
+            int index = find_long(t, name, len);
+            if(index < 0) return bad_option(parser, c, "unknown option", "--", name, len);
+            char *arg = NULL;
+            if(t->options[index].flags & LT_OPT_ARG) {
+                arg = equals ? equals + 1 : i+1 < argc ? argv[++i] : NULL;
+                if(arg == NULL) return bad_option(parser, c, "missing argument for", "--", name, len);
+            } else if(equals) {
+                return bad_option(parser, c, "no argument allowed for", "--", name, len);
+            }
+            values[index].count++;
+            values[index].arg = arg;
+            continue;
+        }
+
+        // a group of short options, the last of which may take an argument
+        for(char *p = word + 1; *p != '\0'; p++) {
+            unsigned char ch = *p;
+            int index = ch < 128 ? t->shorts[ch] : -1;
+            if(index < 0) return bad_option(parser, c, "unknown option", "-", p, 1);
+            values[index].count++;
+            if(t->options[index].flags & LT_OPT_ARG) {
+                char *arg = p[1] != '\0' ? p + 1 : i+1 < argc ? argv[++i] : NULL;
+                if(arg == NULL) return bad_option(parser, c, "missing argument for", "-", p, 1);
+                values[index].arg = arg;
+                break;
+            }
+        }
+    }
+    positional[count] = NULL;
+    return count;
+}
+
+int lt_set_options(LT_Parser *parser, char *command, LT_Option *options) {
+    /*
+     * Gives a command the options it accepts, or removes them if
+     * options is NULL. Returns 0 on success
+     */
+    LT_Command *c = lt_get_command(parser, command);
+    if(c == NULL) return 1;
+    return compile_options(parser, c, options);
+}
+
+LT_Opt_Value *lt_opts(LT_Parser *parser, int *count) {
+    /*
+     * Returns what was given for each of the running command's options,
+     * in the order they were declared, or NULL if it has no options
+     */
+    LT_Context *context = current_context;
+    LT_Opt_Value *opts = context ? context->opts : NULL;
+    if(count) *count = opts ? context->command->opt_table->count : 0;
+    return opts;
+}
+
+static LT_Opt_Value *opt_named(const char *name) {
+    /*
+     * Finds an option of the running command by its long name,
+     * or by its short name given as a one character string
+     */
+    LT_Context *context = current_context;
+    if(context == NULL || context->opts == NULL || name == NULL) return NULL;
+    LT_Opt_Table *t = context->command->opt_table;
+    int index = find_long(t, name, strlen(name));
+    if(index >= 0) return &context->opts[index];
+    unsigned char ch = name[0];
+    if(ch != '\0' && name[1] == '\0' && ch < 128 && t->shorts[ch] >= 0) {
+        return &context->opts[(int)t->shorts[ch]];
+    }
+    return NULL;
+}
+
+int lt_opt_count(LT_Parser *parser, const char *name) {
+    LT_Opt_Value *v = opt_named(name);
+    return v ? v->count : 0;
+}
+
+char *lt_opt_arg(LT_Parser *parser, const char *name) {
+    LT_Opt_Value *v = opt_named(name);
+    return v ? v->arg : NULL;
+}
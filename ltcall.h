@@ -0,0 +1,110 @@
+#ifndef __LTCALL
+#define __LTCALL
+#include "libtalaris.h"
+#include "wordsplit.h"
+#include <pthread.h>
+
+typedef struct lt_stage {
+    LT_Parser *parser;
+    LT_Command *command;    /* NULL to look the command up by argv[0] */
+    int argc;
+    char **argv;
+    ws_op op;               /* operator following the command */
+    LT_Stream *in, *out;
+    int retval;
+    lt_status status;
+    pthread_t thread;
+} LT_Stage;
+
+/* commands waiting to be executed, and the state of the chain so far */
+typedef struct lt_exec {
+    LT_Stage *stages;
+    int count, cap;
+    int retval;
+    lt_status status;       /* of the last command executed */
+    int executed;
+    ws_op prev;
+} LT_Exec;
+
+void call_command(LT_Stage*);
+void exec_push(LT_Exec*, int, char**, ws_op, LT_Command*);
+void exec_alias(LT_Parser*, LT_Exec*, int, char**, ws_op);
+void exec_run(LT_Parser*, LT_Exec*, int);
+void exec_free(LT_Exec*);
+
+typedef struct lt_opt_table {
+    LT_Option *options;
+    int count;
+    signed char shorts[128];    /* index of each short option, or -1 */
+} LT_Opt_Table;
+
+/* state of the command running on this thread, for lt_args and lt_opts */
+typedef struct lt_context {
+    LT_Command *command;
+    LT_Value *values;
+    int count;
+    LT_Opt_Value *opts;
+} LT_Context;
+
+LT_Context *context_swap(LT_Context*);
+int compile_args(LT_Parser*, LT_Command*, LT_Arg*);
+void clear_schema(LT_Parser*, LT_Command*);
+int convert_args(LT_Parser*, LT_Command*, int, char**, LT_Value*);
+int compile_options(LT_Parser*, LT_Command*, LT_Option*);
+void clear_options(LT_Parser*, LT_Command*);
+int parse_options(LT_Parser*, LT_Command*, int, char**, char**, LT_Opt_Value*);
+
+void command_index(LT_Parser*);
+int prefix_range(LT_Parser*, const char*, int*);
+LT_Command *resolve_command(LT_Parser*, char*, lt_status*);
+void print_candidates(LT_Parser*, char*);
+void view_add(LT_Parser*, LT_Command*);
+void view_remove(LT_Parser*, LT_Command*);
+LT_View *view_get(LT_Parser*, int);
+void view_clear(LT_Parser*);
+void view_free(LT_Parser*);
+LT_Command **view_prefix(LT_Parser*, int, const char*, int*);
+
+void help_index_add(LT_Parser*, LT_Command*);
+void help_index_remove(LT_Parser*, LT_Command*);
+void help_index_free(LT_Parser*);
+void help_prepare(LT_Parser*);
+int help_list(LT_Parser*);
+void help_catalog_close(LT_Parser*);
+const char *command_help(LT_Parser*, LT_Command*, int, int*);
+void print_usage(LT_Parser*, LT_Command*, const char*);
+
+/* what lt_input is completing from */
+extern char **matching_commands;
+extern LT_Parser *completing_parser;
+char **command_completion(const char*, int, int);
+void completion_reset(void);
+void history_sync(LT_Parser*);
+
+/* adding up the memory held by a parser, see lt_memory */
+void memory_add(LT_Memory*, lt_mem_category, size_t);
+void memory_items(LT_Memory*, lt_mem_category, size_t, size_t);
+/* the bytes of a hash table's own two allocations, its handles being part of the items */
+#define TABLE_BYTES(hh, head) ((head) != NULL ? HASH_OVERHEAD(hh, head) - HASH_CNT(hh, head) * sizeof(UT_hash_handle) : 0)
+#define MEMORY_TABLE(m, category, hh, head) do { \
+    if((head) != NULL) { \
+        (m)->bytes[category] += TABLE_BYTES(hh, head); \
+        (m)->allocations[category] += 2; \
+    } \
+} while(0)
+void help_memory(LT_Parser*, LT_Memory*);
+void completion_memory(LT_Parser*, LT_Memory*);
+void history_memory(LT_Parser*, LT_Memory*);
+
+void *pool_calloc(LT_Parser*, size_t, size_t, lt_mem_category);
+void pool_release(LT_Parser*, void*, size_t, size_t, lt_mem_category);
+char *pool_intern(LT_Parser*, const char*);
+void pool_drop(LT_Parser*, char*);
+void pool_reset(LT_Parser*);
+void pool_free(LT_Parser*);
+void pool_memory(LT_Parser*, LT_Memory*);
+
+LT_Alias *find_alias(LT_Parser*, char*);
+void free_args(LT_Parser*);
+
+#endif
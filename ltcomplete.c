@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+#include "ltalloc.h"
+#include "libtalaris.h"
+#include "ltcall.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+
+#define LT_PATH_CACHE 64  /* directory listings kept for lt_complete_paths */
+
+char **matching_commands = NULL;
+LT_Parser *completing_parser = NULL;
+
+/* the command whose arguments are being completed */
+static struct {
+    LT_Command *command;
+    char **words;   /* the tokenized line before the word being completed */
+    int argc;
+    char **argv;
+} completing;
+
+/*
+ * Command names matching the last prefix completed, kept while a line
+ * is read. The names belong to the matches array given to lt_input,
+ * or to the parser's commands, whose generation shows when they were
+ * last added or removed
+ */
+static struct {
+    char **source;
+    LT_Parser *parser;
+    unsigned long generation;
+    char *prefix;
+    char **matches;
+    int count, cap;
+} cache;
+
+static void cache_add(char *name) {
+    if(cache.count == cache.cap) {
+        cache.cap = cache.cap ? cache.cap * 2 : 16;
+        cache.matches = lt_realloc(cache.matches, sizeof(char*) * cache.cap);
+        assert(cache.matches);
+    }
+    cache.matches[cache.count++] = name;
+}
+
+/* a directory's entries, sorted, as of its modification time */
+typedef struct lt_dir {
+    char *key;
+    struct timespec mtime;
+    char **names;
+    int count;
+    UT_hash_handle hh;
+} LT_Dir;
+
+static LT_Dir *dirs = NULL;
+
+char **generate_command_list(LT_Parser *parser) {
+    LT_View *v = view_get(parser, LT_VIEW_SHOW);
+    char **command_list = lt_malloc(sizeof(char*) * (v->count+1));
+    assert(command_list);
+    for(int i = 0; i < v->count; i++) command_list[i] = lt_strdup(v->commands[i]->key);
+    command_list[v->count] = NULL;
+    return command_list;
+}
+
+static void cache_matches(const char *text) {
+    /*
+     * Brings the cached names starting with text up to date. When
+     * text extends the last prefix, as it does with each tab press
+     * while typing, the last matches are narrowed down rather than
+     * all the names being searched again
+     */
+    size_t len = strlen(text);
+    int valid = cache.prefix != NULL && cache.source == matching_commands && cache.parser == completing_parser
+        && cache.generation == completing_parser->generation && strncmp(text, cache.prefix, strlen(cache.prefix)) == 0;
+    if(valid) {
+        int count = 0;
+        for(int i = 0; i < cache.count; i++) {
+            if(strncmp(cache.matches[i], text, len) == 0) cache.matches[count++] = cache.matches[i];
+        }
+        cache.count = count;
+    } else {
+        cache.count = 0;
+        if(matching_commands != NULL) {
+            for(int i = 0; matching_commands[i] != NULL; i++) {
+                if(strncmp(matching_commands[i], text, len) == 0) cache_add(matching_commands[i]);
+            }
+        } else {
+            int count;
+            LT_Command **shown = view_prefix(completing_parser, LT_VIEW_SHOW, text, &count);
+            for(int i = 0; i < count; i++) cache_add(shown[i]->key);
+        }
+        cache.source = matching_commands;
+        cache.parser = completing_parser;
+        cache.generation = completing_parser->generation;
+    }
+    lt_free(cache.prefix);
+    cache.prefix = lt_strdup(text);
+    assert(cache.prefix);
+}
+
+void completion_reset(void) {
+    // the names may not outlive the line they were completed for
+    lt_free(cache.prefix);
+    cache.prefix = NULL;
+    cache.count = 0;
+}
+
+void completion_memory(LT_Parser *parser, LT_Memory *m) {
+    /*
+     * The names cached for the line being read, if it's being read by
+     * parser. Listings of directories are shared by every parser, so
+     * they aren't counted
+     */
+    if(cache.parser != parser) return;
+    if(cache.matches) memory_add(m, lt_mem_completion, sizeof(char*) * cache.cap);
+    if(cache.prefix) memory_add(m, lt_mem_completion, strlen(cache.prefix) + 1);
+}
+
+char *command_generator(const char *text, int state) {
+    static int list_index;
+    if(!state) {
+        list_index = 0;
+        cache_matches(text);
+    }
+    if(list_index < cache.count) return strdup(cache.matches[list_index++]);
+    return NULL;
+}
+
+static char *argument_generator(const char *text, int state) {
+    // candidates are handed to readline one at a time as it asks for them
+    const char *match = completing.command->complete(completing.argc, completing.argv, text, state, completing_parser);
+    return match ? strdup(match) : NULL;
+}
+
+static LT_Command *command_before(int start) {
+    /*
+     * Tokenizes the line up to the word being completed, keeping the
+     * words of the last command for its completer. Returns that
+     * command, or NULL if a command name is being completed
+     */
+    lt_free(completing.words);
+    completing.words = NULL;
+    completing.argc = 0;
+    if(completing_parser == NULL || start == 0) return NULL;
+
+    char *line = lt_strndup(rl_line_buffer, start);
+    assert(line);
+    WS_Range *ranges;
+    int count = ws_chain(line, &completing.words, &ranges, NULL, NULL);
+    lt_free(line);
+    LT_Command *c = NULL;
+    // a separator at the end means a new command is being started
+    if(count > 0 && ranges[count-1].op == WS_END) {
+        completing.argv = completing.words + ranges[count-1].start;
+        completing.argc = ranges[count-1].argc;
+        lt_status status;
+        c = resolve_command(completing_parser, completing.argv[0], &status);
+    }
+    lt_free(ranges);
+    return c;
+}
+
+char **command_completion(const char *text, int start, int end) {
+    /*
+     * Completes the arguments of commands that have a completer,
+     * and command names everywhere else
+     */
+    rl_attempted_completion_over = 1;
+    LT_Command *c = command_before(start);
+    if(c != NULL && c->complete != NULL) {
+        completing.command = c;
+        return rl_completion_matches(text, argument_generator);
+    }
+    return rl_completion_matches(text, command_generator);
+}
+
+
+int lt_set_completer(LT_Parser *parser, char *command, lt_completer complete) {
+    LT_Command *c = lt_get_command(parser, command);
+    if(c == NULL) return 1;
+    c->complete = complete;
+    return 0;
+}
+
+const char *lt_complete_commands(int argc, char **argv, const char *text, int state, LT_Parser *parser) {
+    /*
+     * Completer for arguments that are command names, as for help
+     */
+    static LT_Command **shown;
+    static int next, count;
+    if(!state) {
+        shown = view_prefix(parser, LT_VIEW_SHOW, text, &count);
+        next = 0;
+    }
+    return next < count ? shown[next++]->key : NULL;
+}
+
+const char *lt_complete_vars(int argc, char **argv, const char *text, int state, LT_Parser *parser) {
+    /*
+     * Completer for arguments that are variable names, as for set and unset
+     */
+    static LT_Var *next;
+    static size_t len;
+    if(!state) {
+        next = parser->vars;
+        len = strlen(text);
+    }
+    while(next != NULL) {
+        LT_Var *v = next;
+        next = next->hh.next;
+        if(strncmp(v->key, text, len) == 0) return v->key;
+    }
+    return NULL;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char**)a, *(char**)b);
+}
+
+static LT_Dir *list_dir(const char *path) {
+    /*
+     * Returns the entries of the directory at path, read again only if
+     * the directory has changed since it was last listed. The oldest
+     * listing is dropped once LT_PATH_CACHE are kept
+     */
+    struct stat st;
+    if(stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) return NULL;
+    LT_Dir *d = NULL;
+    HASH_FIND_STR(dirs, path, d);
+    if(d != NULL && d->mtime.tv_sec == st.st_mtim.tv_sec && d->mtime.tv_nsec == st.st_mtim.tv_nsec) return d;
+
+    DIR *dp = opendir(path);
+    if(dp == NULL) return NULL;
+    WS_Builder b = {0};
+    struct dirent *entry;
+    while((entry = readdir(dp)) != NULL) {
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        ws_word(&b, entry->d_name);
+    }
+    closedir(dp);
+    int count = b.nslots;
+    char **names = ws_build(&b);
+    qsort(names, count, sizeof(char*), compare_names);
+
+    if(d == NULL) {
+        if(HASH_COUNT(dirs) >= LT_PATH_CACHE) {
+            // entries are kept in the order they were added
+            LT_Dir *oldest = dirs;
+            HASH_DEL(dirs, oldest);
+            lt_free(oldest->key);
+            lt_free(oldest->names);
+            lt_free(oldest);
+        }
+        d = lt_calloc(1, sizeof(LT_Dir));
+        assert(d);
+        d->key = lt_strdup(path);
+        assert(d->key);
+        HASH_ADD_KEYPTR(hh, dirs, d->key, strlen(d->key), d);
+    } else {
+        lt_free(d->names);
+    }
+    d->names = names;
+    d->count = count;
+    d->mtime = st.st_mtim;
+    return d;
+}
+
+const char *lt_complete_paths(int argc, char **argv, const char *text, int state, LT_Parser *parser) {
+    /*
+     * Completer for arguments that are file paths. Directory listings
+     * are cached, so each tab press only needs a stat of the directory
+     * and a binary search of its sorted entries
+     */
+    static LT_Dir *dir;
+    static int next, end, hidden;
+    static char *result;
+    static size_t cap, dir_len;
+    if(!state) {
+        // let readline mark directories and quote awkward names
+        rl_filename_completion_desired = 1;
+        const char *slash = strrchr(text, '/');
+        dir_len = slash ? (size_t)(slash - text) + 1 : 0;
+        char *path = dir_len ? lt_strndup(text, dir_len) : lt_strdup(".");
+        assert(path);
+        dir = list_dir(path);
+        lt_free(path);
+
+        const char *base = text + dir_len;
+        size_t len = strlen(base);
+        hidden = base[0] == '.';
+        int lo = 0, hi = dir ? dir->count : 0;
+        while(lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if(strcmp(dir->names[mid], base) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        next = end = lo;
+        while(dir && end < dir->count && strncmp(dir->names[end], base, len) == 0) end++;
+
+        if(cap < dir_len + 1) {
+            cap = dir_len + 256;
+            result = lt_realloc(result, cap);
+            assert(result);
+        }
+        memcpy(result, text, dir_len);
+    }
+    while(next < end) {
+        char *name = dir->names[next++];
+        // hidden files are only offered once a '.' has been typed
+        if(name[0] == '.' && !hidden) continue;
+        size_t len = strlen(name);
+        if(cap < dir_len + len + 1) {
+            cap = dir_len + len + 256;
+            result = lt_realloc(result, cap);
+            assert(result);
+        }
+        memcpy(result + dir_len, name, len + 1);
+        return result;
+    }
+    return NULL;
+}
@@ -0,0 +1,522 @@
+#include "ltalloc.h"
+#include "libtalaris.h"
+#include "ltcall.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * The words of every command's name and help text, each with the
+ * commands that use it. Commands are added to it as they are added to
+ * the parser, so searching never has to read the help text itself
+ */
+
+#define LT_TERM_MAX 32          /* longer words are cut short */
+#define LT_HELP_WIDTH 24        /* longer names don't widen the name column */
+
+/* how much a word counts for where it was found */
+#define WEIGHT_NAME 8
+#define WEIGHT_HELP 3
+#define WEIGHT_EXTENDED 1
+
+typedef struct lt_posting {
+    LT_Command *command;
+    int weight;
+} LT_Posting;
+
+typedef struct lt_term {
+    char key[LT_TERM_MAX];
+    LT_Posting *postings;
+    int count, cap;
+    UT_hash_handle hh;
+} LT_Term;
+
+/*
+ * The lines help lists, as of a version of the help view. Only help
+ * given when commands were added is laid out ahead of time. Commands
+ * whose help comes from the catalog or loader are noted where their
+ * lines go, and looked up each time, so that help isn't kept around
+ */
+typedef struct lt_lazy_line {
+    size_t at;      /* offset in text */
+    LT_Command *command;
+} LT_Lazy_Line;
+
+struct lt_listing {
+    char *text;
+    size_t len, size;
+    LT_Lazy_Line *lazy;
+    int nlazy, lazy_cap;
+    int width;
+    unsigned long version;
+};
+
+/*
+ * A file of help text mapped into memory, with a line for each command
+ *     name<TAB>help<TAB>extended help
+ * sorted by name, so a command's line can be found by a binary search
+ * that only touches the pages it looks at
+ */
+struct lt_catalog {
+    char *map;
+    size_t size;
+};
+
+/* a word of one command, while it is added or removed */
+typedef struct lt_word {
+    char key[LT_TERM_MAX];
+    int weight;
+    UT_hash_handle hh;
+} LT_Word;
+
+/* a command matching a search, and how well */
+typedef struct lt_hit {
+    LT_Command *command;
+    int terms;
+    int score;
+    UT_hash_handle hh;
+} LT_Hit;
+
+static const char *next_term(const char *text, char *term) {
+    /*
+     * Copies the next word of text into term in lower case, and
+     * returns the position after it, or NULL at the end of text.
+     * Single letters are skipped
+     */
+    for(;;) {
+        while(*text && !isalnum((unsigned char)*text) && *text != '_') text++;
+        if(*text == '\0') return NULL;
+        int len = 0;
+        while(isalnum((unsigned char)*text) || *text == '_') {
+            if(len < LT_TERM_MAX - 1) term[len++] = tolower((unsigned char)*text);
+            text++;
+        }
+        term[len] = '\0';
+        if(len > 1) return text;
+    }
+}
+
+static void collect(LT_Word **words, const char *text, int weight) {
+    char term[LT_TERM_MAX];
+    while(text != NULL && (text = next_term(text, term)) != NULL) {
+        LT_Word *w = NULL;
+        HASH_FIND_STR(*words, term, w);
+        if(w == NULL) {
+            w = lt_calloc(1, sizeof(LT_Word));
+            assert(w);
+            strcpy(w->key, term);
+            HASH_ADD_STR(*words, key, w);
+        }
+        w->weight += weight;
+    }
+}
+
+static LT_Word *command_words(LT_Command *c) {
+    /*
+     * Returns each distinct word of the command's name
+     * and help, weighted by where and how often it appears
+     */
+    LT_Word *words = NULL;
+    collect(&words, c->key, WEIGHT_NAME);
+    collect(&words, c->help, WEIGHT_HELP);
+    collect(&words, c->help_extended, WEIGHT_EXTENDED);
+    return words;
+}
+
+int lt_help_catalog(LT_Parser *parser, const char *path) {
+    /*
+     * Uses a catalog file for the help of commands added without any.
+     * Returns 0 on success
+     */
+    assert(parser);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return 1;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return 1;
+    // lookups jump around the file, so don't read ahead of them
+    madvise(map, st.st_size, MADV_RANDOM);
+
+    help_catalog_close(parser);
+    parser->catalog = lt_malloc(sizeof(LT_Catalog));
+    assert(parser->catalog);
+    parser->catalog->map = map;
+    parser->catalog->size = st.st_size;
+    return 0;
+}
+
+void help_catalog_close(LT_Parser *parser) {
+    if(parser->catalog == NULL) return;
+    munmap(parser->catalog->map, parser->catalog->size);
+    lt_free(parser->catalog);
+    parser->catalog = NULL;
+}
+
+void lt_set_help_loader(LT_Parser *parser, lt_help_loader loader, void *ctx) {
+    /*
+     * Asks loader for the help of commands added without any,
+     * when neither they nor the catalog have it
+     */
+    assert(parser);
+    parser->help_loader = loader;
+    parser->help_loader_ctx = ctx;
+}
+
+static int compare_name(const char *name, const char *line, const char *end) {
+    // compares name to the first field of line, like strcmp
+    while(line < end && *line != '\t' && *line != '\n') {
+        if(*name != *line) return (unsigned char)*name - (unsigned char)*line;
+        name++;
+        line++;
+    }
+    return *name != '\0';
+}
+
+static const char *catalog_find(LT_Catalog *cat, const char *name, const char **end) {
+    /*
+     * Returns the line for name, setting *end to where it ends,
+     * or NULL if the catalog has no line for it
+     */
+    const char *map = cat->map;
+    size_t lo = 0, hi = cat->size;
+    while(lo < hi) {
+        // back up to the start of the line the middle falls in
+        size_t start = lo + (hi - lo) / 2;
+        while(start > lo && map[start-1] != '\n') start--;
+        const char *line_end = memchr(map + start, '\n', cat->size - start);
+        if(line_end == NULL) line_end = map + cat->size;
+        int cmp = compare_name(name, map + start, line_end);
+        if(cmp == 0) {
+            *end = line_end;
+            return map + start;
+        }
+        if(cmp > 0) {
+            lo = line_end - map + 1;
+        } else {
+            hi = start;
+        }
+    }
+    return NULL;
+}
+
+const char *command_help(LT_Parser *parser, LT_Command *c, int extended, int *len) {
+    /*
+     * Returns a command's help, or extended help, and sets *len to its
+     * length, since text from the catalog isn't NUL terminated. Help
+     * given when the command was added comes first, then the
+     * catalog's, then the loader's. Returns NULL if there is none
+     */
+    const char *text = extended ? c->help_extended : c->help;
+    if(text == NULL && parser->catalog != NULL) {
+        const char *end;
+        const char *line = catalog_find(parser->catalog, c->key, &end);
+        for(int field = 0; line != NULL && field <= extended + 1; field++) {
+            const char *tab = memchr(line, '\t', end - line);
+            if(field == extended + 1) {
+                // the extended help runs to the end of the line
+                const char *stop = extended || tab == NULL ? end : tab;
+                *len = stop - line;
+                return line;
+            }
+            line = tab ? tab + 1 : NULL;
+        }
+    }
+    if(text == NULL && parser->help_loader != NULL) {
+        text = parser->help_loader(parser, c->key, extended, parser->help_loader_ctx);
+    }
+    if(text != NULL) *len = strlen(text);
+    return text;
+}
+
+void print_usage(LT_Parser *parser, LT_Command *c, const char *indent) {
+    int len;
+    const char *usage = command_help(parser, c, 1, &len);
+    if(usage != NULL) lt_printf(parser, "%s%.*s\n", indent, len, usage);
+}
+
+static void render(LT_Listing *l, LT_View *v) {
+    /*
+     * Lays out a line for each command shown in help, with the help
+     * text lined up after the names
+     */
+    int width = 0;
+    size_t size = 1;
+    int nlazy = 0;
+    for(int i = 0; i < v->count; i++) {
+        LT_Command *c = v->commands[i];
+        int len = strlen(c->key);
+        if(len > width && len <= LT_HELP_WIDTH) width = len;
+        if(c->help != NULL) {
+            size += (len > LT_HELP_WIDTH ? len : LT_HELP_WIDTH) + 3 + strlen(c->help);
+        } else {
+            nlazy++;
+        }
+    }
+    l->text = lt_realloc(l->text, size);
+    assert(l->text);
+    l->size = size;
+    if(nlazy > l->lazy_cap) {
+        l->lazy = lt_realloc(l->lazy, sizeof(LT_Lazy_Line) * nlazy);
+        assert(l->lazy);
+        l->lazy_cap = nlazy;
+    }
+    l->len = 0;
+    l->nlazy = 0;
+    l->width = width;
+    for(int i = 0; i < v->count; i++) {
+        LT_Command *c = v->commands[i];
+        if(c->help != NULL) {
+            l->len += sprintf(l->text + l->len, "%-*s  %s\n", width, c->key, c->help);
+        } else {
+            l->lazy[l->nlazy].at = l->len;
+            l->lazy[l->nlazy].command = c;
+            l->nlazy++;
+        }
+    }
+    l->text[l->len] = '\0';
+    l->version = v->version;
+}
+
+static int page_break(LT_Parser *parser, int *lines, int written) {
+    // flushes after every parser->help_page lines, returning 1 once the reader has gone
+    *lines += written;
+    if(parser->help_page <= 0 || *lines < parser->help_page) return 0;
+    *lines = 0;
+    return lt_flush(parser) != 0;
+}
+
+void help_prepare(LT_Parser *parser) {
+    // lays out the listing again if the commands shown in help have changed
+    if(parser->listing == NULL) {
+        parser->listing = lt_calloc(1, sizeof(LT_Listing));
+        assert(parser->listing);
+    }
+    LT_Listing *l = parser->listing;
+    LT_View *v = view_get(parser, LT_VIEW_HELP);
+    if(l->text == NULL || l->version != v->version) render(l, v);
+}
+
+int help_list(LT_Parser *parser) {
+    /*
+     * Writes the help line of every command shown in help, in order of
+     * name. The lines laid out ahead of time go out in as few writes
+     * as possible, unless parser->help_page asks for them to be flushed
+     * a page at a time. Help from the catalog or loader is looked up
+     * once for each line as it is written
+     */
+    help_prepare(parser);
+    LT_Listing *l = parser->listing;
+
+    size_t start = 0;
+    int lines = 0;
+    for(int i = 0; i <= l->nlazy; i++) {
+        size_t stop = i < l->nlazy ? l->lazy[i].at : l->len;
+        if(parser->help_page <= 0) {
+            if(stop > start && lt_write(parser, l->text + start, stop - start) != 0) return 1;
+            start = stop;
+        }
+        while(start < stop) {
+            // the rest of the page, or as much as comes before the next looked up line
+            size_t end = start;
+            int page = 0;
+            while(end < stop && lines + page < parser->help_page) {
+                end = strchr(l->text + end, '\n') - l->text + 1;
+                page++;
+            }
+            // stop once the reader has gone, such as a pager being quit
+            if(lt_write(parser, l->text + start, end - start) != 0 || page_break(parser, &lines, page)) return 1;
+            start = end;
+        }
+        if(i == l->nlazy) break;
+
+        LT_Command *c = l->lazy[i].command;
+        int len;
+        const char *help = command_help(parser, c, 0, &len);
+        if(help) {
+            lt_printf(parser, "%-*s  %.*s\n", l->width, c->key, len, help);
+        } else {
+            lt_printf(parser, "%s\n", c->key);
+        }
+        if(page_break(parser, &lines, 1)) return 1;
+    }
+    return 0;
+}
+
+void help_index_add(LT_Parser *parser, LT_Command *c) {
+    LT_Word *words = command_words(c), *w, *tmp;
+    HASH_ITER(hh, words, w, tmp) {
+        LT_Term *t = NULL;
+        HASH_FIND_STR(parser->help_terms, w->key, t);
+        if(t == NULL) {
+            t = lt_calloc(1, sizeof(LT_Term));
+            assert(t);
+            strcpy(t->key, w->key);
+            HASH_ADD_STR(parser->help_terms, key, t);
+        }
+        if(t->count == t->cap) {
+            t->cap = t->cap ? t->cap * 2 : 4;
+            t->postings = lt_realloc(t->postings, sizeof(LT_Posting) * t->cap);
+            assert(t->postings);
+        }
+        t->postings[t->count].command = c;
+        t->postings[t->count].weight = w->weight;
+        t->count++;
+        HASH_DEL(words, w);
+        lt_free(w);
+    }
+}
+
+void help_index_remove(LT_Parser *parser, LT_Command *c) {
+    LT_Word *words = command_words(c), *w, *tmp;
+    HASH_ITER(hh, words, w, tmp) {
+        LT_Term *t = NULL;
+        HASH_FIND_STR(parser->help_terms, w->key, t);
+        for(int i = 0; t != NULL && i < t->count; i++) {
+            if(t->postings[i].command != c) continue;
+            t->postings[i] = t->postings[--t->count];
+            break;
+        }
+        if(t != NULL && t->count == 0) {
+            HASH_DEL(parser->help_terms, t);
+            lt_free(t->postings);
+            lt_free(t);
+        }
+        HASH_DEL(words, w);
+        lt_free(w);
+    }
+}
+
+void help_index_free(LT_Parser *parser) {
+    if(parser->listing) {
+        lt_free(parser->listing->text);
+        lt_free(parser->listing->lazy);
+        lt_free(parser->listing);
+        parser->listing = NULL;
+    }
+    LT_Term *t, *tmp;
+    HASH_ITER(hh, parser->help_terms, t, tmp) {
+        HASH_DEL(parser->help_terms, t);
+        lt_free(t->postings);
+        lt_free(t);
+    }
+}
+
+void help_memory(LT_Parser *parser, LT_Memory *m) {
+    pool_memory(parser, m);
+    MEMORY_TABLE(m, lt_mem_help, hh, parser->help_terms);
+    LT_Term *t, *tmp;
+    HASH_ITER(hh, parser->help_terms, t, tmp) {
+        memory_add(m, lt_mem_help, sizeof(LT_Term));
+        if(t->cap) memory_add(m, lt_mem_help, sizeof(LT_Posting) * t->cap);
+    }
+    if(parser->listing) {
+        memory_add(m, lt_mem_help, sizeof(LT_Listing));
+        if(parser->listing->text) memory_add(m, lt_mem_help, parser->listing->size);
+        if(parser->listing->lazy) memory_add(m, lt_mem_help, sizeof(LT_Lazy_Line) * parser->listing->lazy_cap);
+    }
+    // the catalog itself is mapped, and only takes memory as it is read
+    if(parser->catalog) memory_add(m, lt_mem_help, sizeof(LT_Catalog));
+}
+
+static int compare_hits(const void *a, const void *b) {
+    // most words matched first, then the highest score, then by name
+    const LT_Hit *x = *(LT_Hit**)a, *y = *(LT_Hit**)b;
+    if(x->terms != y->terms) return y->terms - x->terms;
+    if(x->score != y->score) return y->score - x->score;
+    return strcmp(x->command->key, y->command->key);
+}
+
+int lt_search_help(LT_Parser *parser, const char *query, LT_Command **out, int max) {
+    /*
+     * Fills out with up to max commands whose name or help mention the
+     * words of query, best matches first, and returns how many were
+     * found. Commands matching more of the words rank higher, then
+     * those with the words in their name or short help
+     */
+    if(parser == NULL || query == NULL || out == NULL || max <= 0) return 0;
+    LT_Hit *hits = NULL, *h, *tmp;
+    int nhits = 0;
+    LT_Word *words = NULL, *w, *w_tmp;
+    collect(&words, query, 1);
+    HASH_ITER(hh, words, w, w_tmp) {
+        LT_Term *t = NULL;
+        HASH_FIND_STR(parser->help_terms, w->key, t);
+        HASH_DEL(words, w);
+        lt_free(w);
+        for(int i = 0; t != NULL && i < t->count; i++) {
+            LT_Command *c = t->postings[i].command;
+            if(!LT_IS_HELP(c->state)) continue;
+            HASH_FIND_PTR(hits, &c, h);
+            if(h == NULL) {
+                h = lt_calloc(1, sizeof(LT_Hit));
+                assert(h);
+                h->command = c;
+                HASH_ADD_PTR(hits, command, h);
+                nhits++;
+            }
+            h->terms++;
+            h->score += t->postings[i].weight;
+        }
+    }
+
+    LT_Hit **ranked = lt_malloc(sizeof(LT_Hit*) * (nhits ? nhits : 1));
+    assert(ranked);
+    int n = 0;
+    HASH_ITER(hh, hits, h, tmp) ranked[n++] = h;
+    qsort(ranked, n, sizeof(LT_Hit*), compare_hits);
+    int count = n < max ? n : max;
+    for(int i = 0; i < count; i++) out[i] = ranked[i]->command;
+    lt_free(ranked);
+    HASH_ITER(hh, hits, h, tmp) {
+        HASH_DEL(hits, h);
+        lt_free(h);
+    }
+    return count;
+}
+
+int lt_apropos(int argc, char **argv, LT_Parser *parser) {
+    /*
+     * Lists the commands whose help mentions any of the given words
+     */
+    assert(parser != NULL);
+    if(argc < 2) {
+        // help -k passes its arguments on from the -k
+        const char *name = argc == 0 ? "apropos" : strcmp(argv[0], "-k") == 0 ? "help -k" : argv[0];
+        lt_printf(parser, "Usage: %s WORD...\n", name);
+        return 1;
+    }
+    size_t len = 1;
+    for(int i = 1; i < argc; i++) len += strlen(argv[i]) + 1;
+    char *query = lt_malloc(len);
+    assert(query);
+    query[0] = '\0';
+    for(int i = 1; i < argc; i++) {
+        strcat(query, argv[i]);
+        strcat(query, " ");
+    }
+
+    int max = HASH_COUNT(parser->commands);
+    LT_Command **found = lt_malloc(sizeof(LT_Command*) * (max ? max : 1));
+    assert(found);
+    int count = lt_search_help(parser, query, found, max);
+    if(count == 0) lt_printf(parser, "Nothing appropriate for '%s'\n", argv[1]);
+    for(int i = 0; i < count; i++) {
+        int len = 0;
+        const char *help = command_help(parser, found[i], 0, &len);
+        lt_printf(parser, "%s\t%.*s\n", found[i]->key, len, help ? help : "");
+    }
+    lt_free(found);
+    lt_free(query);
+    return 0;
+}
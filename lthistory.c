@@ -0,0 +1,582 @@
+#include "ltalloc.h"
+#include "libtalaris.h"
+#include "ltcall.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+#include <readline/history.h>
+
+#define LT_HISTORY_INTERVAL 1   /* seconds between writes of new lines */
+#define LT_HISTORY_PENDING 65536    /* bytes of new lines before an early write */
+
+typedef struct lt_hist_entry {
+    struct lt_hist_entry *prev, *next;  /* oldest to newest */
+    struct lt_history *owner;
+    UT_hash_handle hh;
+    uint32_t id;        /* larger for newer lines */
+    UT_hash_handle hh_id;
+    HIST_ENTRY *mirrored;   /* readline's copy, if it has one */
+    size_t len;
+    char line[];
+} LT_Hist_Entry;
+
+/*
+ * The IDs of the lines containing three characters, oldest first, in
+ * ids[first] to ids[count-1]. The oldest line is forgotten most often,
+ * so its ID is dropped by moving first rather than the rest of the IDs
+ */
+typedef struct lt_trigram {
+    uint32_t key;
+    uint32_t *ids;
+    int first, count, cap;
+    UT_hash_handle hh;
+} LT_Trigram;
+
+struct lt_history {
+    LT_Hist_Entry *index;   /* every line, hashed so repeats are found at once */
+    LT_Hist_Entry *oldest, *newest;
+    int count;
+    size_t bytes, max_bytes;
+    int loading;    /* readline's history is filled in once loading is done */
+    int stale;      /* copies of forgotten lines still in readline's history */
+
+    /* trigram index for searches, whose size counts towards max_bytes */
+    LT_Trigram *trigrams;
+    LT_Hist_Entry *by_id;
+    uint32_t next_id;
+    size_t index_bytes;
+
+    /* lines waiting to be appended to the file by the writer thread */
+    int fd;
+    char *pending;
+    size_t pending_len, pending_cap;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int closing;
+};
+
+static void write_pending(LT_History *h) {
+    /*
+     * Called with the lock held. The buffer is swapped out so the
+     * lock isn't held while writing
+     */
+    char *data = h->pending;
+    size_t len = h->pending_len;
+    h->pending = NULL;
+    h->pending_len = h->pending_cap = 0;
+    pthread_mutex_unlock(&h->lock);
+    size_t done = 0;
+    while(done < len) {
+        ssize_t written = write(h->fd, data + done, len - done);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        done += written;
+    }
+    lt_free(data);
+    pthread_mutex_lock(&h->lock);
+}
+
+static void *writer(void *arg) {
+    LT_History *h = arg;
+    pthread_mutex_lock(&h->lock);
+    while(!h->closing) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += LT_HISTORY_INTERVAL;
+        pthread_cond_timedwait(&h->wake, &h->lock, &until);
+        if(h->pending_len > 0) write_pending(h);
+    }
+    if(h->pending_len > 0) write_pending(h);
+    pthread_mutex_unlock(&h->lock);
+    return NULL;
+}
+
+static int search_key(int, int);
+
+static uint32_t trigram_at(const char *str) {
+    return (uint32_t)(unsigned char)str[0] << 16 | (uint32_t)(unsigned char)str[1] << 8 | (unsigned char)str[2];
+}
+
+static void resize_ids(LT_History *h, LT_Trigram *t, int cap) {
+    // moves the IDs to the front and makes room for cap of them
+    if(t->first > 0) {
+        memmove(t->ids, t->ids + t->first, sizeof(uint32_t) * (t->count - t->first));
+        t->count -= t->first;
+        t->first = 0;
+    }
+    if(cap == t->cap) return;
+    t->ids = lt_realloc(t->ids, sizeof(uint32_t) * cap);
+    assert(t->ids);
+    h->index_bytes += sizeof(uint32_t) * cap;
+    h->index_bytes -= sizeof(uint32_t) * t->cap;
+    t->cap = cap;
+}
+
+static void index_entry(LT_History *h, LT_Hist_Entry *e) {
+    for(size_t i = 0; i + 3 <= e->len; i++) {
+        uint32_t key = trigram_at(e->line + i);
+        LT_Trigram *t = NULL;
+        HASH_FIND(hh, h->trigrams, &key, sizeof(uint32_t), t);
+        if(t == NULL) {
+            t = lt_calloc(1, sizeof(LT_Trigram));
+            assert(t);
+            t->key = key;
+            HASH_ADD(hh, h->trigrams, key, sizeof(uint32_t), t);
+            h->index_bytes += sizeof(LT_Trigram);
+        }
+        // IDs only grow, so a repeat within the line is always last
+        if(t->count > t->first && t->ids[t->count-1] == e->id) continue;
+        if(t->count == t->cap) {
+            int live = t->count - t->first;
+            resize_ids(h, t, live * 2 > t->cap ? t->cap * 2 : t->cap ? t->cap : 4);
+        }
+        t->ids[t->count++] = e->id;
+    }
+}
+
+static int find_id(LT_Trigram *t, uint32_t id) {
+    int lo = t->first, hi = t->count;
+    while(lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if(t->ids[mid] < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < t->count && t->ids[lo] == id ? lo : -1;
+}
+
+static void unindex_entry(LT_History *h, LT_Hist_Entry *e) {
+    /*
+     * Takes a line's ID out of the lists of its trigrams. Lines are
+     * mostly forgotten for being the oldest, at the front of each list,
+     * or for being entered again, usually near the end
+     */
+    for(size_t i = 0; i + 3 <= e->len; i++) {
+        uint32_t key = trigram_at(e->line + i);
+        LT_Trigram *t = NULL;
+        HASH_FIND(hh, h->trigrams, &key, sizeof(uint32_t), t);
+        int at = t ? find_id(t, e->id) : -1;
+        if(at < 0) continue;
+        if(at == t->first) {
+            t->first++;
+        } else {
+            memmove(t->ids + at, t->ids + at + 1, sizeof(uint32_t) * (t->count - at - 1));
+            t->count--;
+        }
+        int live = t->count - t->first;
+        if(live == 0) {
+            HASH_DEL(h->trigrams, t);
+            h->index_bytes -= sizeof(LT_Trigram) + sizeof(uint32_t) * t->cap;
+            lt_free(t->ids);
+            lt_free(t);
+        } else if(live * 4 <= t->cap && t->cap > 4) {
+            resize_ids(h, t, t->cap / 2);
+        }
+    }
+}
+
+static void free_trigrams(LT_History *h) {
+    LT_Trigram *t, *tmp;
+    HASH_ITER(hh, h->trigrams, t, tmp) {
+        HASH_DEL(h->trigrams, t);
+        lt_free(t->ids);
+        lt_free(t);
+    }
+    h->index_bytes = 0;
+}
+
+static size_t held(LT_History *h) {
+    // what max_bytes limits: the lines, their index and the hash tables
+    return h->bytes + h->index_bytes + TABLE_BYTES(hh, h->index) + TABLE_BYTES(hh_id, h->by_id) + TABLE_BYTES(hh, h->trigrams);
+}
+
+/* marks readline's copies of forgotten lines until they are swept out */
+static char forgotten;
+
+static void sweep(LT_History *h) {
+    /*
+     * Drops the copies of forgotten lines from readline's history in one
+     * pass, rather than one remove_history at a time. The rest are moved
+     * to the end, keeping their order, and stifling the history to their
+     * number frees the copies left at the front
+     */
+    if(h->stale == 0) return;
+    HIST_ENTRY **list = history_list();
+    int keep = history_length;
+    for(int i = history_length - 1; i >= 0; i--) {
+        if(list[i]->data == &forgotten) continue;
+        HIST_ENTRY *swap = list[--keep];
+        list[keep] = list[i];
+        list[i] = swap;
+    }
+    int base = history_base;
+    int stifled = history_is_stifled();
+    int max = unstifle_history();
+    stifle_history(history_length - keep);
+    unstifle_history();
+    if(stifled) stifle_history(max);
+    history_base = base;
+    h->stale = 0;
+}
+
+void history_sync(LT_Parser *parser) {
+    // before readline shows the history
+    if(parser->history != NULL) sweep(parser->history);
+}
+
+static void unlink_entry(LT_History *h, LT_Hist_Entry *e) {
+    /*
+     * Removes an entry from the index and the order. Its copy in
+     * readline's history is only marked, to be swept out later
+     */
+    if(e->mirrored != NULL) {
+        e->mirrored->data = &forgotten;
+        h->stale++;
+    }
+    HASH_DEL(h->index, e);
+    HASH_DELETE(hh_id, h->by_id, e);
+    unindex_entry(h, e);
+    if(e->prev) e->prev->next = e->next;
+    else h->oldest = e->next;
+    if(e->next) e->next->prev = e->prev;
+    else h->newest = e->prev;
+    h->bytes -= sizeof(LT_Hist_Entry) + e->len + 1;
+    h->count--;
+    lt_free(e);
+}
+
+static void mirror(LT_History *h, LT_Hist_Entry *e) {
+    // readline keeps its own copy, tagged so it can be found again
+    HIST_ENTRY **list = history_list();
+    if(history_is_stifled() && list != NULL && history_length >= history_max_entries && history_length > 0) {
+        // the oldest copy is about to be dropped by readline itself
+        void *data = list[0]->data;
+        if(data == &forgotten) {
+            h->stale--;
+        } else if(data != NULL && ((LT_Hist_Entry*)data)->owner == h) {
+            ((LT_Hist_Entry*)data)->mirrored = NULL;
+        }
+    }
+    add_history(e->line);
+    list = history_list();
+    e->mirrored = list != NULL ? list[history_length-1] : NULL;
+    if(e->mirrored) e->mirrored->data = e;
+}
+
+static void remember(LT_History *h, const char *line, size_t len) {
+    /*
+     * Makes line the newest entry, dropping an earlier copy of it
+     * and then the oldest entries while over the memory cap
+     */
+    LT_Hist_Entry *e = NULL;
+    HASH_FIND(hh, h->index, line, len, e);
+    if(e != NULL) unlink_entry(h, e);
+
+    e = lt_malloc(sizeof(LT_Hist_Entry) + len + 1);
+    assert(e);
+    memcpy(e->line, line, len);
+    e->line[len] = '\0';
+    e->len = len;
+    e->owner = h;
+    e->mirrored = NULL;
+    e->next = NULL;
+    e->prev = h->newest;
+    if(h->newest) h->newest->next = e;
+    else h->oldest = e;
+    h->newest = e;
+    HASH_ADD_KEYPTR(hh, h->index, e->line, len, e);
+    e->id = h->next_id++;
+    HASH_ADD(hh_id, h->by_id, id, sizeof(uint32_t), e);
+    index_entry(h, e);
+    h->bytes += sizeof(LT_Hist_Entry) + len + 1;
+    h->count++;
+
+    if(!h->loading) mirror(h, e);
+    while(held(h) > h->max_bytes && h->oldest != e) unlink_entry(h, h->oldest);
+    // sweeping once half of readline's history is stale keeps each line's share small
+    if(h->stale > history_length / 2) sweep(h);
+}
+
+static int load(LT_History *h, const char *path) {
+    /*
+     * Reads the lines already in the file by mapping it. Returns
+     * the number of lines, including repeats
+     */
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return 0;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return 0;
+
+    int lines = 0;
+    h->loading = 1;
+    char *pos = map, *end = map + st.st_size;
+    while(pos < end) {
+        char *newline = memchr(pos, '\n', end - pos);
+        char *stop = newline ? newline : end;
+        if(stop > pos) {
+            remember(h, pos, stop - pos);
+            lines++;
+        }
+        pos = stop + 1;
+    }
+    munmap(map, st.st_size);
+    h->loading = 0;
+    for(LT_Hist_Entry *e = h->oldest; e != NULL; e = e->next) mirror(h, e);
+    return lines;
+}
+
+static void compact(LT_History *h, const char *path) {
+    /*
+     * Rewrites the file with only the lines still remembered,
+     * replacing it in one step so it is never left half written
+     */
+    size_t len = strlen(path);
+    char *tmp = lt_malloc(len + 5);
+    assert(tmp);
+    snprintf(tmp, len + 5, "%s.new", path);
+    FILE *fp = fopen(tmp, "w");
+    if(fp != NULL) {
+        int ok = 1;
+        for(LT_Hist_Entry *e = h->oldest; e != NULL && ok; e = e->next) {
+            ok = fwrite(e->line, 1, e->len, fp) == e->len && fputc('\n', fp) != EOF;
+        }
+        if(fclose(fp) == 0 && ok) {
+            rename(tmp, path);
+        } else {
+            unlink(tmp);
+        }
+    }
+    lt_free(tmp);
+}
+
+int lt_history_open(LT_Parser *parser, const char *path, size_t max_bytes) {
+    /*
+     * Keeps the parser's input history in the file at path. The lines
+     * already there are loaded into readline's history, and lines read
+     * by lt_input are appended by a background thread. Each line is kept
+     * once, and the oldest lines are forgotten once they use more than
+     * max_bytes (LT_HISTORY_MAX if 0). Returns 0 on success
+     */
+    if(parser == NULL || path == NULL || parser->history != NULL) return 1;
+    LT_History *h = lt_calloc(1, sizeof(LT_History));
+    assert(h);
+    h->max_bytes = max_bytes ? max_bytes : LT_HISTORY_MAX;
+    int lines = load(h, path);
+    // the file only grows, so drop the lines that have been forgotten
+    if(lines > 2 * h->count) compact(h, path);
+
+    h->fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    pthread_mutex_init(&h->lock, NULL);
+    pthread_cond_init(&h->wake, NULL);
+    if(h->fd < 0 || pthread_create(&h->thread, NULL, writer, h) != 0) {
+        if(parser->verbosity >= lt_warning) fprintf(stderr, "Warning: Could not keep history in %s\n", path);
+        if(h->fd >= 0) close(h->fd);
+        h->fd = -1;
+    }
+    parser->history = h;
+    rl_bind_key(CTRL('R'), search_key);
+    return h->fd < 0;
+}
+
+void lt_history_add(LT_Parser *parser, const char *line) {
+    /*
+     * Adds a line to the history, or to readline's history
+     * alone if the parser has no history file
+     */
+    if(parser == NULL || line == NULL || line[0] == '\0') return;
+    LT_History *h = parser->history;
+    if(h == NULL) {
+        // leave out repeats of the previous line
+        HIST_ENTRY *last = history_length > 0 ? history_get(history_base + history_length - 1) : NULL;
+        if(last == NULL || strcmp(last->line, line) != 0) add_history(line);
+        return;
+    }
+    size_t len = strlen(line);
+    if(h->newest != NULL && h->newest->len == len && memcmp(h->newest->line, line, len) == 0) return;
+    remember(h, line, len);
+    if(h->fd < 0) return;
+
+    pthread_mutex_lock(&h->lock);
+    if(h->pending_len + len + 1 > h->pending_cap) {
+        size_t cap = h->pending_cap ? h->pending_cap : 1024;
+        while(cap < h->pending_len + len + 1) cap *= 2;
+        h->pending = lt_realloc(h->pending, cap);
+        assert(h->pending);
+        h->pending_cap = cap;
+    }
+    memcpy(h->pending + h->pending_len, line, len);
+    h->pending[h->pending_len + len] = '\n';
+    h->pending_len += len + 1;
+    if(h->pending_len >= LT_HISTORY_PENDING) pthread_cond_signal(&h->wake);
+    pthread_mutex_unlock(&h->lock);
+}
+
+int lt_history_count(LT_Parser *parser) {
+    if(parser == NULL || parser->history == NULL) return 0;
+    return parser->history->count;
+}
+
+void lt_history_close(LT_Parser *parser) {
+    /*
+     * Writes any lines not yet in the file and forgets the history.
+     * The lines stay in readline's history
+     */
+    if(parser == NULL || parser->history == NULL) return;
+    LT_History *h = parser->history;
+    if(h->fd >= 0) {
+        pthread_mutex_lock(&h->lock);
+        h->closing = 1;
+        pthread_cond_signal(&h->wake);
+        pthread_mutex_unlock(&h->lock);
+        pthread_join(h->thread, NULL);
+        close(h->fd);
+    }
+    sweep(h);
+    HIST_ENTRY **list = history_list();
+    for(int i = 0; list != NULL && i < history_length; i++) {
+        LT_Hist_Entry *e = list[i]->data;
+        if(e != NULL && e->owner == h) list[i]->data = NULL;
+    }
+    HASH_CLEAR(hh_id, h->by_id);
+    LT_Hist_Entry *e, *tmp;
+    HASH_ITER(hh, h->index, e, tmp) {
+        HASH_DEL(h->index, e);
+        lt_free(e);
+    }
+    free_trigrams(h);
+    lt_free(h->pending);
+    pthread_mutex_destroy(&h->lock);
+    pthread_cond_destroy(&h->wake);
+    lt_free(h);
+    parser->history = NULL;
+}
+
+void history_memory(LT_Parser *parser, LT_Memory *m) {
+    LT_History *h = parser->history;
+    if(h == NULL) return;
+    memory_add(m, lt_mem_history, sizeof(LT_History));
+    MEMORY_TABLE(m, lt_mem_history, hh, h->index);
+    MEMORY_TABLE(m, lt_mem_history, hh_id, h->by_id);
+    // each entry's size, with its line, is already kept in h->bytes
+    m->bytes[lt_mem_history] += h->bytes;
+    m->allocations[lt_mem_history] += h->count;
+    MEMORY_TABLE(m, lt_mem_history, hh, h->trigrams);
+    // every trigram has its node and its IDs
+    m->bytes[lt_mem_history] += h->index_bytes;
+    m->allocations[lt_mem_history] += 2 * HASH_COUNT(h->trigrams);
+    pthread_mutex_lock(&h->lock);
+    if(h->pending) memory_add(m, lt_mem_history, h->pending_cap);
+    pthread_mutex_unlock(&h->lock);
+}
+
+static int compare_lists(const void *a, const void *b) {
+    LT_Trigram *x = *(LT_Trigram**)a, *y = *(LT_Trigram**)b;
+    return (x->count - x->first) - (y->count - y->first);
+}
+
+static int search(LT_History *h, const char *query, uint32_t before, LT_Hist_Entry **out, int max) {
+    /*
+     * Finds up to max lines containing query with IDs below before,
+     * newest first. Queries of three or more characters only look at
+     * the lines that have all of the query's trigrams, walking the
+     * shortest list of IDs and looking the rest up in the others
+     */
+    size_t len = strlen(query);
+    int count = 0;
+    if(len < 3) {
+        for(LT_Hist_Entry *e = h->newest; e != NULL && count < max; e = e->prev) {
+            if(e->id < before && strstr(e->line, query) != NULL) out[count++] = e;
+        }
+        return count;
+    }
+
+    int nlists = len - 2;
+    LT_Trigram **lists = lt_malloc(sizeof(LT_Trigram*) * nlists);
+    assert(lists);
+    for(int i = 0; i < nlists; i++) {
+        uint32_t key = trigram_at(query + i);
+        HASH_FIND(hh, h->trigrams, &key, sizeof(uint32_t), lists[i]);
+        if(lists[i] == NULL) {
+            lt_free(lists);
+            return 0;
+        }
+    }
+    qsort(lists, nlists, sizeof(LT_Trigram*), compare_lists);
+    LT_Trigram *shortest = lists[0];
+    for(int i = shortest->count - 1; i >= shortest->first && count < max; i--) {
+        uint32_t id = shortest->ids[i];
+        if(id >= before) continue;
+        int found = 1;
+        for(int j = 1; j < nlists && found; j++) found = find_id(lists[j], id) >= 0;
+        if(!found) continue;
+        LT_Hist_Entry *e = NULL;
+        HASH_FIND(hh_id, h->by_id, &id, sizeof(uint32_t), e);
+        // the trigrams may be in the line without being next to each other
+        if(e != NULL && strstr(e->line, query) != NULL) out[count++] = e;
+    }
+    lt_free(lists);
+    return count;
+}
+
+int lt_history_search(LT_Parser *parser, const char *query, const char **out, int max) {
+    /*
+     * Fills out with up to max history lines containing query, newest
+     * first, and returns how many were found. The lines belong to the
+     * history and are only valid until the next line is added
+     */
+    if(parser == NULL || parser->history == NULL || query == NULL || out == NULL || max <= 0) return 0;
+    LT_Hist_Entry **found = lt_malloc(sizeof(LT_Hist_Entry*) * max);
+    assert(found);
+    int count = search(parser->history, query, UINT32_MAX, found, max);
+    for(int i = 0; i < count; i++) out[i] = found[i]->line;
+    lt_free(found);
+    return count;
+}
+
+static int search_key(int count, int key) {
+    /*
+     * Bound to Control-R while lt_input reads a line. Replaces the line
+     * with the newest history line containing what was typed, and
+     * pressing it again steps back to older matches
+     */
+    static char *query = NULL;
+    static uint32_t before;
+    LT_History *h = completing_parser ? completing_parser->history : NULL;
+    if(h == NULL) return rl_reverse_search_history(count, key);
+
+    if(rl_last_func != search_key || query == NULL) {
+        lt_free(query);
+        query = lt_strdup(rl_line_buffer);
+        assert(query);
+        before = UINT32_MAX;
+    }
+    LT_Hist_Entry *e;
+    if(search(h, query, before, &e, 1) == 0) {
+        rl_ding();
+        return 0;
+    }
+    before = e->id;
+    rl_replace_line(e->line, 0);
+    rl_point = rl_end;
+    return 0;
+}
@@ -0,0 +1,314 @@
+#include "ltalloc.h"
+#include "libtalaris.h"
+#include "ltcall.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+
+/* at most this many edits apart to be suggested, by length of the word */
+#define SUGGEST_DISTANCE(len) ((len) <= 2 ? 1 : (len) <= 5 ? 2 : 3)
+
+static int compare_commands(const void *a, const void *b) {
+    return strcmp((*(LT_Command**)a)->key, (*(LT_Command**)b)->key);
+}
+
+static uint64_t char_mask(const char *str) {
+    // one bit per character, folded onto 64 bits
+    uint64_t mask = 0;
+    while(*str) mask |= 1ULL << ((unsigned char)*str++ & 63);
+    return mask;
+}
+
+static int bit_count(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+}
+
+void command_index(LT_Parser *parser) {
+    /*
+     * Brings the parser's sorted list of commands up to date. It is
+     * only rebuilt after commands or aliases are added or removed
+     */
+    if(parser->sorted_generation == parser->generation) return;
+    int count = HASH_COUNT(parser->commands);
+    size_t size = count ? count : 1;
+    parser->sorted = lt_realloc(parser->sorted, sizeof(LT_Command*) * size);
+    parser->masks = lt_realloc(parser->masks, sizeof(unsigned long long) * size);
+    parser->lengths = lt_realloc(parser->lengths, sizeof(int) * size);
+    assert(parser->sorted && parser->masks && parser->lengths);
+    int i = 0;
+    LT_Command *c, *tmp;
+    HASH_ITER(hh, parser->commands, c, tmp) {
+        parser->sorted[i++] = c;
+    }
+    qsort(parser->sorted, count, sizeof(LT_Command*), compare_commands);
+    for(i = 0; i < count; i++) {
+        parser->masks[i] = char_mask(parser->sorted[i]->key);
+        parser->lengths[i] = strlen(parser->sorted[i]->key);
+    }
+    parser->nsorted = count;
+    parser->sorted_generation = parser->generation;
+}
+
+int prefix_range(LT_Parser *parser, const char *prefix, int *first) {
+    /*
+     * Finds the commands whose names start with prefix, which are next
+     * to each other in the sorted list. Sets *first to the index of
+     * the first of them and returns how many there are
+     */
+    command_index(parser);
+    size_t len = strlen(prefix);
+    int lo = 0, hi = parser->nsorted;
+    while(lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if(strcmp(parser->sorted[mid]->key, prefix) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *first = lo;
+    hi = lo;
+    while(hi < parser->nsorted && strncmp(parser->sorted[hi]->key, prefix, len) == 0) hi++;
+    return hi - lo;
+}
+
+static int abbreviable(LT_Command *c) {
+    // commands hidden from help have to be typed out in full
+    return LT_IS_EXEC(c->state) && LT_IS_SHOW(c->state);
+}
+
+LT_Command *resolve_command(LT_Parser *parser, char *name, lt_status *status) {
+    /*
+     * Looks a command up by name, or when abbreviations are on, by
+     * a prefix matching only one command. Sets *status to
+     * lt_ambiguous if the prefix matches several
+     */
+    LT_Command *c = lt_get_command(parser, name);
+    if(c != NULL || !parser->abbreviate || name[0] == '\0') return c;
+
+    int first;
+    int count = prefix_range(parser, name, &first);
+    for(int i = first; i < first + count; i++) {
+        if(!abbreviable(parser->sorted[i])) continue;
+        if(c != NULL) {
+            *status = lt_ambiguous;
+            return NULL;
+        }
+        c = parser->sorted[i];
+    }
+    return c;
+}
+
+void print_candidates(LT_Parser *parser, char *name) {
+    int first;
+    int count = prefix_range(parser, name, &first);
+    lt_printf(parser, "'%s' is ambiguous. It could be:", name);
+    for(int i = first; i < first + count; i++) {
+        if(abbreviable(parser->sorted[i])) lt_printf(parser, " %s", parser->sorted[i]->key);
+    }
+    lt_printf(parser, "\n");
+}
+
+static int in_view(int view, lt_state state) {
+    switch(view) {
+        case LT_VIEW_HELP: return LT_IS_HELP(state);
+        default: return LT_IS_SHOW(state);
+    }
+}
+
+static int view_position(LT_View *v, const char *key) {
+    // where key is in the view, or would be
+    int lo = 0, hi = v->count;
+    while(lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if(strcmp(v->commands[mid]->key, key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void view_settle(LT_View *v) {
+    /*
+     * Sorts the commands added since the view was last read and merges
+     * them into the rest, so adding many commands at once costs one
+     * sort rather than moving the list along for each of them
+     */
+    int added = v->count - v->sorted;
+    if(added == 0) return;
+    LT_Command **tail = lt_malloc(sizeof(LT_Command*) * added);
+    assert(tail);
+    memcpy(tail, v->commands + v->sorted, sizeof(LT_Command*) * added);
+    qsort(tail, added, sizeof(LT_Command*), compare_commands);
+    // merged from the back, where the added commands were
+    int i = v->sorted - 1, j = added - 1, k = v->count - 1;
+    while(j >= 0) {
+        if(i >= 0 && strcmp(v->commands[i]->key, tail[j]->key) > 0) {
+            v->commands[k--] = v->commands[i--];
+        } else {
+            v->commands[k--] = tail[j--];
+        }
+    }
+    lt_free(tail);
+    v->sorted = v->count;
+}
+
+LT_View *view_get(LT_Parser *parser, int view) {
+    // the view in order of name
+    view_settle(&parser->views[view]);
+    return &parser->views[view];
+}
+
+void view_add(LT_Parser *parser, LT_Command *c) {
+    /*
+     * Adds a command to the views its state puts it in. It is put in
+     * order the next time the view is read
+     */
+    for(int view = 0; view < LT_VIEWS; view++) {
+        if(!in_view(view, c->state)) continue;
+        LT_View *v = &parser->views[view];
+        if(v->count == v->cap) {
+            v->cap = v->cap ? v->cap * 2 : 16;
+            v->commands = lt_realloc(v->commands, sizeof(LT_Command*) * v->cap);
+            assert(v->commands);
+        }
+        v->commands[v->count++] = c;
+        v->version++;
+    }
+}
+
+void view_remove(LT_Parser *parser, LT_Command *c) {
+    for(int view = 0; view < LT_VIEWS; view++) {
+        if(!in_view(view, c->state)) continue;
+        LT_View *v = view_get(parser, view);
+        int i = view_position(v, c->key);
+        if(i == v->count || v->commands[i] != c) continue;
+        v->count--;
+        v->sorted--;
+        memmove(v->commands + i, v->commands + i + 1, sizeof(LT_Command*) * (v->count - i));
+        v->version++;
+    }
+}
+
+void view_free(LT_Parser *parser) {
+    for(int view = 0; view < LT_VIEWS; view++) {
+        lt_free(parser->views[view].commands);
+        parser->views[view] = (LT_View){0};
+    }
+}
+
+void view_clear(LT_Parser *parser) {
+    // empties the views, keeping their arrays for the next commands
+    for(int view = 0; view < LT_VIEWS; view++) {
+        parser->views[view].count = parser->views[view].sorted = 0;
+        parser->views[view].version++;
+    }
+}
+
+LT_Command **view_prefix(LT_Parser *parser, int view, const char *prefix, int *count) {
+    /*
+     * Returns the first command in a view whose name starts with
+     * prefix, and sets *count to how many follow it
+     */
+    LT_View *v = view_get(parser, view);
+    size_t len = strlen(prefix);
+    int first = view_position(v, prefix), last = first;
+    while(last < v->count && strncmp(v->commands[last]->key, prefix, len) == 0) last++;
+    *count = last - first;
+    return v->commands + first;
+}
+
+int lt_set_state(LT_Parser *parser, char *command, lt_state state) {
+    /*
+     * Changes whether a command is shown in help and can be run,
+     * updating the lists help and completion use at once
+     */
+    LT_Command *c = lt_get_command(parser, command);
+    if(c == NULL) return 1;
+    view_remove(parser, c);
+    c->state = state;
+    view_add(parser, c);
+    // cached completions may hold the command
+    parser->generation++;
+    return 0;
+}
+
+static int edit_distance(const uint64_t *peq, int m, const char *text) {
+    /*
+     * Levenshtein distance between a word of m <= 64 characters,
+     * whose character positions are in peq, and text. Uses Myers'
+     * bit-parallel algorithm, handling a whole column per step
+     */
+    uint64_t pv = ~0ULL, mv = 0, high = 1ULL << (m - 1);
+    int score = m;
+    for(; *text; text++) {
+        uint64_t eq = peq[(unsigned char)*text];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+        if(ph & high) {
+            score++;
+        } else if(mh & high) {
+            score--;
+        }
+        // shifting in a 1 charges for skipping the start of the word
+        ph = (ph << 1) | 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
+    return score;
+}
+
+int lt_suggest(LT_Parser *parser, const char *word, char **out, int max) {
+    /*
+     * Finds up to max commands with names a few edits away from word,
+     * closest first, for unfound callbacks to suggest. The names in
+     * out belong to the parser. Commands are ruled out by length and
+     * by the letters they contain before any distances are worked out.
+     * Returns the number found
+     */
+    if(parser == NULL || word == NULL || out == NULL || max <= 0) return 0;
+    int m = strlen(word);
+    if(m == 0 || m > 64) return 0;
+    command_index(parser);
+
+    int limit = SUGGEST_DISTANCE(m);
+    uint64_t mask = char_mask(word);
+    uint64_t peq[256] = {0};
+    for(int i = 0; i < m; i++) peq[(unsigned char)word[i]] |= 1ULL << i;
+
+    int distances[max];
+    int count = 0;
+    for(int i = 0; i < parser->nsorted; i++) {
+        // each letter in only one of the two needs an edit of its own.
+        // The tests are combined since few commands pass them
+        int diff = parser->lengths[i] - m;
+        uint64_t other = parser->masks[i];
+        if((diff > limit) | (-diff > limit) | (bit_count(mask & ~other) > limit) | (bit_count(other & ~mask) > limit)) continue;
+        LT_Command *c = parser->sorted[i];
+        if(!abbreviable(c)) continue;
+        int d = edit_distance(peq, m, c->key);
+        if(d > limit) continue;
+
+        // insert in order of distance, keeping the sorted order of names
+        int j = count < max ? count++ : max - 1;
+        while(j > 0 && distances[j-1] > d) {
+            distances[j] = distances[j-1];
+            out[j] = out[j-1];
+            j--;
+        }
+        distances[j] = d;
+        out[j] = c->key;
+        // once out is full, only closer commands are of interest
+        if(count == max) limit = distances[max-1] - 1;
+    }
+    return count;
+}
@@ -0,0 +1,292 @@
+#include "ltalloc.h"
+#include "libtalaris.h"
+#include "ltoutput.h"
+#include "ltcall.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+typedef enum lt_sink {
+    lt_sink_fd,
+    lt_sink_memory,
+    lt_sink_writer,
+    lt_sink_stream
+} lt_sink;
+
+struct lt_output {
+    lt_sink sink;
+    int fd;
+    lt_writer writer;
+    void *ctx;
+    LT_Stream *stream;
+
+    /* buffered data, one block per iovec */
+    struct iovec *blocks;
+    size_t *sizes;      /* what was allocated for each block */
+    int count, cap;
+    size_t total;
+};
+
+static __thread LT_Output *current_output = NULL;
+
+LT_Output *output_create(void) {
+    LT_Output *o = lt_calloc(1, sizeof(LT_Output));
+    assert(o);
+    o->sink = lt_sink_fd;
+    o->fd = STDOUT_FILENO;
+    return o;
+}
+
+LT_Output *output_for_stream(LT_Stream *stream) {
+    LT_Output *o = output_create();
+    o->sink = lt_sink_stream;
+    o->stream = stream;
+    return o;
+}
+
+static void discard(LT_Output *o) {
+    for(int i = 0; i < o->count; i++) lt_free(o->blocks[i].iov_base);
+    o->count = 0;
+    o->total = 0;
+}
+
+void output_destroy(LT_Output *o) {
+    if(o == NULL) return;
+    discard(o);
+    lt_free(o->blocks);
+    lt_free(o->sizes);
+    lt_free(o);
+}
+
+static char *reserve(LT_Output *o, size_t len) {
+    /*
+     * Returns space for len more bytes at the end of the buffer,
+     * starting a new block rather than moving existing data
+     */
+    struct iovec *last = o->count ? &o->blocks[o->count-1] : NULL;
+    if(last && o->sizes[o->count-1] - last->iov_len >= len) {
+        return (char*)last->iov_base + last->iov_len;
+    }
+    if(o->count == o->cap) {
+        o->cap = o->cap ? o->cap * 2 : 8;
+        o->blocks = lt_realloc(o->blocks, sizeof(struct iovec) * o->cap);
+        o->sizes = lt_realloc(o->sizes, sizeof(size_t) * o->cap);
+        assert(o->blocks && o->sizes);
+    }
+    size_t size = len > LT_OUTPUT_BLOCK ? len : LT_OUTPUT_BLOCK;
+    last = &o->blocks[o->count++];
+    last->iov_base = lt_malloc(size);
+    assert(last->iov_base);
+    last->iov_len = 0;
+    o->sizes[o->count-1] = size;
+    return last->iov_base;
+}
+
+static void commit(LT_Output *o, size_t len) {
+    o->blocks[o->count-1].iov_len += len;
+    o->total += len;
+    if(o->total >= LT_OUTPUT_FLUSH && o->sink != lt_sink_memory) output_flush(o);
+}
+
+int output_write(LT_Output *o, const char *data, size_t len) {
+    assert(o);
+    if(len == 0) return 0;
+    memcpy(reserve(o, len), data, len);
+    commit(o, len);
+    return 0;
+}
+
+int output_vprintf(LT_Output *o, const char *format, va_list args) {
+    assert(o);
+    va_list copy;
+    va_copy(copy, args);
+    // try to format straight into the space left in the last block
+    size_t room = o->count ? o->sizes[o->count-1] - o->blocks[o->count-1].iov_len : 0;
+    char *dest = o->count ? (char*)o->blocks[o->count-1].iov_base + o->blocks[o->count-1].iov_len : NULL;
+    int len = vsnprintf(dest, room, format, args);
+    if(len >= 0 && (size_t)len >= room) {
+        dest = reserve(o, len + 1);
+        vsnprintf(dest, len + 1, format, copy);
+    }
+    va_end(copy);
+    if(len < 0) return -1;
+    commit(o, len);
+    return len;
+}
+
+static int flush_fd(LT_Output *o) {
+    if(o->fd == STDOUT_FILENO) fflush(stdout);
+    struct iovec *iov = o->blocks;
+    int count = o->count;
+    while(count > 0) {
+        ssize_t written = writev(o->fd, iov, count > IOV_MAX ? IOV_MAX : count);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        // step past whatever was written, which may end partway through a block
+        while(count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+int output_flush(LT_Output *o) {
+    /*
+     * Sends everything buffered to the output's destination.
+     * Memory outputs keep their data until lt_output_clear
+     */
+    if(o == NULL || o->sink == lt_sink_memory || o->count == 0) return 0;
+    int retval = 0;
+    switch(o->sink) {
+        case lt_sink_fd:
+            // flush_fd moves the block pointers, so keep the originals to free
+            {
+                void **bases = lt_malloc(sizeof(void*) * o->count);
+                assert(bases);
+                for(int i = 0; i < o->count; i++) bases[i] = o->blocks[i].iov_base;
+                retval = flush_fd(o);
+                for(int i = 0; i < o->count; i++) o->blocks[i].iov_base = bases[i];
+                lt_free(bases);
+            }
+            break;
+        case lt_sink_writer:
+            for(int i = 0; i < o->count && retval == 0; i++) {
+                retval = o->writer(o->blocks[i].iov_base, o->blocks[i].iov_len, o->ctx);
+            }
+            break;
+        case lt_sink_stream:
+            // hand the blocks over to the stream without copying them
+            for(int i = 0; i < o->count; i++) {
+                if(retval == 0) {
+                    retval = lt_stream_push(o->stream, o->blocks[i].iov_base, o->blocks[i].iov_len);
+                } else {
+                    lt_free(o->blocks[i].iov_base);
+                }
+            }
+            o->count = 0;
+            break;
+        default:
+            break;
+    }
+    discard(o);
+    return retval;
+}
+
+void output_memory(LT_Output *o, LT_Memory *m) {
+    if(o == NULL) return;
+    memory_add(m, lt_mem_other, sizeof(LT_Output));
+    if(o->blocks) memory_add(m, lt_mem_other, sizeof(struct iovec) * o->cap);
+    if(o->sizes) memory_add(m, lt_mem_other, sizeof(size_t) * o->cap);
+    for(int i = 0; i < o->count; i++) memory_add(m, lt_mem_other, o->sizes[i]);
+}
+
+LT_Output *output_current(void) {
+    return current_output;
+}
+
+LT_Output *output_swap(LT_Output *o) {
+    LT_Output *old = current_output;
+    current_output = o;
+    return old;
+}
+
+static LT_Output *output_of(LT_Parser *parser) {
+    if(current_output) return current_output;
+    return parser ? parser->output : NULL;
+}
+
+int lt_write(LT_Parser *parser, const char *data, size_t len) {
+    /*
+     * Writes to the output of the running call, or the
+     * parser's output outside of a call
+     */
+    LT_Output *o = output_of(parser);
+    if(o == NULL) return fwrite(data, 1, len, stdout) == len ? 0 : -1;
+    return output_write(o, data, len);
+}
+
+int lt_printf(LT_Parser *parser, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    LT_Output *o = output_of(parser);
+    int retval = o ? output_vprintf(o, format, args) : vprintf(format, args);
+    va_end(args);
+    return retval;
+}
+
+int lt_flush(LT_Parser *parser) {
+    return output_flush(output_of(parser));
+}
+
+static void redirect(LT_Parser *parser, lt_sink sink) {
+    assert(parser);
+    output_flush(parser->output);
+    discard(parser->output);
+    parser->output->sink = sink;
+}
+
+void lt_output_to_fd(LT_Parser *parser, int fd) {
+    redirect(parser, lt_sink_fd);
+    parser->output->fd = fd;
+}
+
+void lt_output_to_memory(LT_Parser *parser) {
+    redirect(parser, lt_sink_memory);
+}
+
+void lt_output_to_writer(LT_Parser *parser, lt_writer writer, void *ctx) {
+    redirect(parser, lt_sink_writer);
+    parser->output->writer = writer;
+    parser->output->ctx = ctx;
+}
+
+char *lt_output_data(LT_Parser *parser, size_t *len) {
+    /*
+     * Returns everything captured by a memory output as one NUL
+     * terminated string, which stays owned by the parser
+     */
+    assert(parser);
+    LT_Output *o = parser->output;
+    if(len) *len = o->total;
+    if(o->count == 0) reserve(o, 1);
+    if(o->count > 1 || o->sizes[0] == o->blocks[0].iov_len) {
+        char *data = lt_malloc(o->total + 1);
+        assert(data);
+        size_t offset = 0;
+        for(int i = 0; i < o->count; i++) {
+            memcpy(data + offset, o->blocks[i].iov_base, o->blocks[i].iov_len);
+            offset += o->blocks[i].iov_len;
+        }
+        size_t total = o->total;
+        discard(o);
+        o->blocks[0].iov_base = data;
+        o->blocks[0].iov_len = total;
+        o->count = 1;
+        o->sizes[0] = total + 1;
+        o->total = total;
+    }
+    char *data = o->blocks[0].iov_base;
+    data[o->total] = '\0';
+    return data;
+}
+
+void lt_output_clear(LT_Parser *parser) {
+    assert(parser);
+    discard(parser->output);
+}
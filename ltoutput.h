@@ -0,0 +1,21 @@
+#ifndef __LTOUTPUT
+#define __LTOUTPUT
+#include "libtalaris.h"
+#include <stdarg.h>
+
+#define LT_OUTPUT_BLOCK 4096    /* size of each output buffer block */
+#define LT_OUTPUT_FLUSH 65536   /* buffered bytes before an early flush */
+
+LT_Output *output_create(void);
+LT_Output *output_for_stream(LT_Stream*);
+void output_destroy(LT_Output*);
+int output_write(LT_Output*, const char*, size_t);
+int output_vprintf(LT_Output*, const char*, va_list);
+int output_flush(LT_Output*);
+void output_memory(LT_Output*, LT_Memory*);
+
+/* the output of the call running on this thread, NULL outside of calls */
+LT_Output *output_current(void);
+LT_Output *output_swap(LT_Output*);
+
+#endif
@@ -0,0 +1,221 @@
+#include "ltalloc.h"
+#include "libtalaris.h"
+#include "ltcall.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stddef.h>
+
+/*
+ * Memory kept by a parser for its commands: the commands themselves,
+ * their schemas and options, and strings such as their names and help.
+ * Everything is packed into large blocks, which lt_cleanup or lt_reset
+ * let go of all at once. Pieces given back while the parser is in use,
+ * such as those of a removed command, are kept on a list for their size
+ * and handed out again. Each distinct string is stored once, with the
+ * hash entry that finds it and a count of its users
+ */
+
+#define LT_POOL_BLOCK 2048        /* the first block, each after it twice as big */
+#define LT_POOL_BLOCK_MAX 65536
+
+typedef struct lt_pool_block {
+    struct lt_pool_block *next;
+    size_t used, size;
+    char data[];
+} LT_Pool_Block;
+
+typedef struct lt_pooled {
+    UT_hash_handle hh;
+    int users;
+    char str[];
+} LT_Pooled;
+
+/* pieces of one size that have been given back */
+typedef struct lt_free_list {
+    size_t size;
+    void *head;     /* each piece starts with a pointer to the next */
+    struct lt_free_list *next;
+} LT_Free_List;
+
+struct lt_pool {
+    LT_Pooled *strings;
+    LT_Pool_Block *blocks;  /* newest first */
+    LT_Free_List *free;
+    size_t used[lt_mem_categories];
+};
+
+static LT_Pool *pool_of(LT_Parser *parser) {
+    if(parser->pool == NULL) {
+        parser->pool = lt_calloc(1, sizeof(LT_Pool));
+        assert(parser->pool);
+    }
+    return parser->pool;
+}
+
+static size_t rounded(size_t size) {
+    // keeps the hash entries aligned, and leaves room for a free list's link
+    if(size < sizeof(void*)) size = sizeof(void*);
+    return (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+}
+
+static LT_Free_List *free_list(LT_Pool *pool, size_t size) {
+    // sizes are rounded, so there are only a few of them
+    LT_Free_List *f = pool->free;
+    while(f != NULL && f->size != size) f = f->next;
+    return f;
+}
+
+static void *pool_alloc(LT_Pool *pool, size_t size) {
+    size = rounded(size);
+    LT_Free_List *f = free_list(pool, size);
+    if(f != NULL && f->head != NULL) {
+        void *p = f->head;
+        f->head = *(void**)p;
+        return p;
+    }
+    LT_Pool_Block *b = pool->blocks;
+    if(b == NULL || b->size - b->used < size) {
+        // small parsers stay small, and large ones don't need many blocks
+        size_t block = b == NULL ? LT_POOL_BLOCK : b->size * 2;
+        if(block > LT_POOL_BLOCK_MAX) block = LT_POOL_BLOCK_MAX;
+        if(block < size) block = size;
+        b = lt_malloc(sizeof(LT_Pool_Block) + block);
+        assert(b);
+        b->used = 0;
+        b->size = block;
+        b->next = pool->blocks;
+        pool->blocks = b;
+    }
+    void *p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+static void pool_give_back(LT_Pool *pool, void *p, size_t size) {
+    size = rounded(size);
+    LT_Free_List *f = free_list(pool, size);
+    if(f == NULL) {
+        f = pool_alloc(pool, sizeof(LT_Free_List));
+        f->size = size;
+        f->head = NULL;
+        f->next = pool->free;
+        pool->free = f;
+    }
+    *(void**)p = f->head;
+    f->head = p;
+}
+
+void *pool_calloc(LT_Parser *parser, size_t count, size_t size, lt_mem_category category) {
+    /*
+     * Returns zeroed memory that lasts until the parser's commands
+     * are cleared, counted towards category by lt_memory
+     */
+    LT_Pool *pool = pool_of(parser);
+    void *p = pool_alloc(pool, count * size);
+    memset(p, 0, count * size);
+    pool->used[category] += count * size;
+    return p;
+}
+
+void pool_release(LT_Parser *parser, void *p, size_t count, size_t size, lt_mem_category category) {
+    /*
+     * Gives back memory from pool_calloc, with the same count,
+     * size and category, to be handed out again
+     */
+    if(p == NULL) return;
+    pool_give_back(parser->pool, p, count * size);
+    parser->pool->used[category] -= count * size;
+}
+
+char *pool_intern(LT_Parser *parser, const char *str) {
+    /*
+     * Returns the parser's copy of str, which is the same pointer for
+     * every equal string, until each of its users has dropped it with
+     * pool_drop. NULL stays NULL
+     */
+    if(str == NULL) return NULL;
+    LT_Pool *pool = pool_of(parser);
+    size_t len = strlen(str);
+    LT_Pooled *p = NULL;
+    HASH_FIND(hh, pool->strings, str, len, p);
+    if(p != NULL) {
+        p->users++;
+        return p->str;
+    }
+
+    p = pool_alloc(pool, sizeof(LT_Pooled) + len + 1);
+    memset(&p->hh, 0, sizeof(UT_hash_handle));
+    p->users = 1;
+    memcpy(p->str, str, len + 1);
+    HASH_ADD_KEYPTR(hh, pool->strings, p->str, len, p);
+    pool->used[lt_mem_help] += sizeof(LT_Pooled) + len + 1;
+    return p->str;
+}
+
+void pool_drop(LT_Parser *parser, char *str) {
+    // one user of an interned string is done with it
+    if(str == NULL) return;
+    LT_Pool *pool = parser->pool;
+    LT_Pooled *p = (LT_Pooled*)(str - offsetof(LT_Pooled, str));
+    if(--p->users > 0) return;
+    HASH_DEL(pool->strings, p);
+    size_t size = sizeof(LT_Pooled) + strlen(str) + 1;
+    pool_give_back(pool, p, size);
+    pool->used[lt_mem_help] -= size;
+}
+
+void pool_reset(LT_Parser *parser) {
+    /*
+     * Forgets everything in the pool, keeping its newest and
+     * largest block to fill again
+     */
+    LT_Pool *pool = parser->pool;
+    if(pool == NULL) return;
+    HASH_CLEAR(hh, pool->strings);
+    LT_Pool_Block *keep = pool->blocks;
+    while(keep != NULL && keep->next != NULL) {
+        LT_Pool_Block *next = keep->next->next;
+        lt_free(keep->next);
+        keep->next = next;
+    }
+    if(keep != NULL) keep->used = 0;
+    pool->free = NULL;
+    memset(pool->used, 0, sizeof(pool->used));
+}
+
+void pool_free(LT_Parser *parser) {
+    LT_Pool *pool = parser->pool;
+    if(pool == NULL) return;
+    // the entries live in the blocks, so only the hash table itself needs freeing
+    HASH_CLEAR(hh, pool->strings);
+    while(pool->blocks != NULL) {
+        LT_Pool_Block *next = pool->blocks->next;
+        lt_free(pool->blocks);
+        pool->blocks = next;
+    }
+    lt_free(pool);
+    parser->pool = NULL;
+}
+
+void pool_memory(LT_Parser *parser, LT_Memory *m) {
+    /*
+     * What the pool holds is counted towards what it was used for, and
+     * the blocks themselves, with any room left in them, as commands
+     */
+    LT_Pool *pool = parser->pool;
+    if(pool == NULL) return;
+    memory_add(m, lt_mem_other, sizeof(LT_Pool));
+    MEMORY_TABLE(m, lt_mem_help, hh, pool->strings);
+    size_t used = 0;
+    for(int i = 0; i < lt_mem_categories; i++) {
+        m->bytes[i] += pool->used[i];
+        used += pool->used[i];
+    }
+    size_t held = 0;
+    for(LT_Pool_Block *b = pool->blocks; b != NULL; b = b->next) {
+        memory_add(m, lt_mem_commands, 0);
+        held += sizeof(LT_Pool_Block) + b->size;
+    }
+    m->bytes[lt_mem_commands] += held - used;
+}
@@ -0,0 +1,321 @@
+#define _GNU_SOURCE
+#include "ltalloc.h"
+#include "libtalaris.h"
+#include "ltcall.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * A compiled script is laid out as
+ *     header | name table | word table | commands | strings
+ * The name and word tables hold offsets into the strings, which are
+ * NUL terminated and stored once however often they are used
+ */
+
+#define LT_SCRIPT_MAGIC "LTSC"
+#define LT_SCRIPT_VERSION 1
+#define LT_SCRIPT_TEXT UINT32_MAX   /* the command is a line run with lt_call */
+
+typedef struct lt_script_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t names;     /* distinct command names */
+    uint32_t words;
+    uint32_t commands;
+    uint32_t strings;   /* bytes of string data */
+} LT_Script_Header;
+
+typedef struct lt_script_command {
+    uint32_t name;  /* index into the name table, or LT_SCRIPT_TEXT */
+    uint32_t word;  /* index of argv[0] in the word table, or the offset of the line */
+    uint32_t argc;
+    uint32_t op;    /* ws_op following the command, WS_END at the end of a line */
+} LT_Script_Command;
+
+typedef struct lt_interned {
+    char *key;
+    uint32_t value;
+    UT_hash_handle hh;
+} LT_Interned;
+
+typedef struct lt_script {
+    uint32_t *names, *words;
+    LT_Script_Command *commands;
+    char *strings;
+    LT_Script_Header header;
+    int names_cap, words_cap, commands_cap, strings_cap;
+    LT_Interned *interned, *named;
+} LT_Script;
+
+static void *grow(void *array, int *cap, uint32_t need, size_t size) {
+    if(need <= (uint32_t)*cap) return array;
+    int new_cap = *cap ? *cap : 64;
+    while((uint32_t)new_cap < need) new_cap *= 2;
+    array = lt_realloc(array, new_cap * size);
+    assert(array);
+    *cap = new_cap;
+    return array;
+}
+
+static uint32_t intern(LT_Script *s, char *str) {
+    /*
+     * Returns the offset of str in the string data, adding it the first time
+     */
+    LT_Interned *i = NULL;
+    HASH_FIND_STR(s->interned, str, i);
+    if(i != NULL) return i->value;
+
+    size_t len = strlen(str) + 1;
+    s->strings = grow(s->strings, &s->strings_cap, s->header.strings + len, sizeof(char));
+    memcpy(s->strings + s->header.strings, str, len);
+
+    // the string data may move, so the hash keeps its own copy of the key
+    i = lt_malloc(sizeof(LT_Interned));
+    assert(i);
+    i->value = s->header.strings;
+    s->header.strings += len;
+    i->key = lt_strdup(str);
+    assert(i->key);
+    HASH_ADD_KEYPTR(hh, s->interned, i->key, len-1, i);
+    return i->value;
+}
+
+static uint32_t name_index(LT_Script *s, char *name) {
+    LT_Interned *i = NULL;
+    HASH_FIND_STR(s->named, name, i);
+    if(i != NULL) return i->value;
+
+    s->names = grow(s->names, &s->names_cap, s->header.names + 1, sizeof(uint32_t));
+    s->names[s->header.names] = intern(s, name);
+    i = lt_malloc(sizeof(LT_Interned));
+    assert(i);
+    i->key = lt_strdup(name);
+    assert(i->key);
+    i->value = s->header.names++;
+    HASH_ADD_KEYPTR(hh, s->named, i->key, strlen(i->key), i);
+    return i->value;
+}
+
+static void add_command(LT_Script *s, uint32_t name, uint32_t word, uint32_t argc, uint32_t op) {
+    s->commands = grow(s->commands, &s->commands_cap, s->header.commands + 1, sizeof(LT_Script_Command));
+    LT_Script_Command *c = &s->commands[s->header.commands++];
+    c->name = name;
+    c->word = word;
+    c->argc = argc;
+    c->op = op;
+}
+
+static void free_script(LT_Script *s) {
+    LT_Interned *i, *tmp;
+    HASH_ITER(hh, s->interned, i, tmp) {
+        HASH_DEL(s->interned, i);
+        lt_free(i->key);
+        lt_free(i);
+    }
+    HASH_ITER(hh, s->named, i, tmp) {
+        HASH_DEL(s->named, i);
+        lt_free(i->key);
+        lt_free(i);
+    }
+    lt_free(s->names);
+    lt_free(s->words);
+    lt_free(s->commands);
+    lt_free(s->strings);
+}
+
+static int script_line(char *line) {
+    /*
+     * Strips the newline from line and returns whether it
+     * holds anything to run, skipping blank lines and comments
+     */
+    line[strcspn(line, "\n")] = '\0';
+    while(isspace((unsigned char)*line)) line++;
+    return *line != '\0' && *line != '#';
+}
+
+int lt_run_script(LT_Parser *parser, const char *path) {
+    /*
+     * Runs each line of a script with lt_call, stopping early if a
+     * command returns LT_CALL_FAILED. Returns the value of the last command
+     */
+    if(parser == NULL || path == NULL) return LT_CALL_FAILED;
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL) return LT_CALL_FAILED;
+    char *line = NULL;
+    size_t cap = 0;
+    int retval = 0;
+    while(getline(&line, &cap, fp) != -1) {
+        if(!script_line(line)) continue;
+        retval = lt_call(parser, line);
+        if(retval == LT_CALL_FAILED) break;
+    }
+    free(line);
+    fclose(fp);
+    return retval;
+}
+
+int lt_compile_script(LT_Parser *parser, const char *path, const char *output) {
+    /*
+     * Tokenizes a script ahead of time for lt_run_compiled. Lines that
+     * use variables are kept as text, since they can only be expanded
+     * when they run. Returns 0 on success
+     */
+    if(parser == NULL || path == NULL || output == NULL) return 1;
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL) return 1;
+
+    LT_Script s = {0};
+    char *line = NULL;
+    size_t cap = 0;
+    int number = 0;
+    while(getline(&line, &cap, fp) != -1) {
+        number++;
+        if(!script_line(line)) continue;
+        if(strchr(line, '$') != NULL) {
+            add_command(&s, LT_SCRIPT_TEXT, intern(&s, line), 0, WS_END);
+            continue;
+        }
+
+        char **argv;
+        WS_Range *ranges;
+        int count = ws_chain(line, &argv, &ranges, NULL, NULL);
+        for(int i = 0; i < count; i++) {
+            char **words = argv + ranges[i].start;
+            if(lt_get_command(parser, words[0]) == NULL && find_alias(parser, words[0]) == NULL && parser->verbosity >= lt_warning) {
+                fprintf(stderr, "Warning: %s:%d: unknown command '%s'\n", path, number, words[0]);
+            }
+            uint32_t first = s.header.words;
+            s.words = grow(s.words, &s.words_cap, first + ranges[i].argc, sizeof(uint32_t));
+            for(int j = 0; j < ranges[i].argc; j++) {
+                s.words[s.header.words++] = intern(&s, words[j]);
+            }
+            add_command(&s, name_index(&s, words[0]), first, ranges[i].argc, i == count-1 ? WS_END : ranges[i].op);
+        }
+        lt_free(argv);
+        lt_free(ranges);
+    }
+    free(line);
+    fclose(fp);
+
+    memcpy(s.header.magic, LT_SCRIPT_MAGIC, 4);
+    s.header.version = LT_SCRIPT_VERSION;
+    int retval = 1;
+    FILE *out = fopen(output, "wb");
+    if(out != NULL) {
+        int ok = fwrite(&s.header, sizeof(LT_Script_Header), 1, out) == 1;
+        ok = ok && fwrite(s.names, sizeof(uint32_t), s.header.names, out) == s.header.names;
+        ok = ok && fwrite(s.words, sizeof(uint32_t), s.header.words, out) == s.header.words;
+        ok = ok && fwrite(s.commands, sizeof(LT_Script_Command), s.header.commands, out) == s.header.commands;
+        ok = ok && fwrite(s.strings, 1, s.header.strings, out) == s.header.strings;
+        retval = fclose(out) != 0 || !ok;
+    }
+    free_script(&s);
+    return retval;
+}
+
+static int valid_script(LT_Script_Header *h, size_t size) {
+    if(size < sizeof(LT_Script_Header)) return 0;
+    if(memcmp(h->magic, LT_SCRIPT_MAGIC, 4) != 0 || h->version != LT_SCRIPT_VERSION) return 0;
+    uint64_t need = sizeof(LT_Script_Header);
+    need += (uint64_t)h->names * sizeof(uint32_t);
+    need += (uint64_t)h->words * sizeof(uint32_t);
+    need += (uint64_t)h->commands * sizeof(LT_Script_Command);
+    need += h->strings;
+    if(need != size) return 0;
+    // every string must be terminated inside the data
+    return h->strings == 0 || ((char*)h)[size-1] == '\0';
+}
+
+int lt_run_compiled(LT_Parser *parser, const char *path) {
+    /*
+     * Runs a script made by lt_compile_script. The file is mapped
+     * rather than read, and the words are passed to the callbacks
+     * where they lie. Each command name is looked up once, and again
+     * only if the parser's commands or aliases change during the run
+     */
+    if(parser == NULL || path == NULL) return LT_CALL_FAILED;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return LT_CALL_FAILED;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return LT_CALL_FAILED;
+    }
+    // private and writable, so callbacks may change their arguments as usual
+    char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return LT_CALL_FAILED;
+
+    LT_Script_Header *h = (LT_Script_Header*)map;
+    if(!valid_script(h, st.st_size)) {
+        if(parser->verbosity >= lt_warning) fprintf(stderr, "Warning: %s is not a compiled script\n", path);
+        munmap(map, st.st_size);
+        return LT_CALL_FAILED;
+    }
+    uint32_t *names = (uint32_t*)(h + 1);
+    uint32_t *words = names + h->names;
+    LT_Script_Command *commands = (LT_Script_Command*)(words + h->words);
+    char *strings = (char*)(commands + h->commands);
+
+    LT_Command **resolved = lt_calloc(h->names + 1, sizeof(LT_Command*));
+    char *aliased = lt_calloc(h->names + 1, sizeof(char));
+    assert(resolved && aliased);
+    unsigned long generation = parser->generation + 1;
+
+    free_args(parser);
+    parser->command_id = LT_NO_COMMAND;
+    LT_Exec e = {0};
+    int retval = 0;
+    for(uint32_t i = 0; i < h->commands && retval != LT_CALL_FAILED; i++) {
+        LT_Script_Command *c = &commands[i];
+        if(c->name == LT_SCRIPT_TEXT) {
+            if(c->word < h->strings) retval = lt_call(parser, strings + c->word);
+            continue;
+        }
+        if(c->name >= h->names || c->argc == 0 || c->word > h->words || c->argc > h->words - c->word) continue;
+
+        if(generation != parser->generation) {
+            for(uint32_t n = 0; n < h->names; n++) {
+                char *name = names[n] < h->strings ? strings + names[n] : "";
+                resolved[n] = lt_get_command(parser, name);
+                aliased[n] = find_alias(parser, name) != NULL;
+            }
+            generation = parser->generation;
+        }
+
+        char **argv = lt_malloc(sizeof(char*) * (c->argc + 1));
+        assert(argv);
+        for(uint32_t j = 0; j < c->argc; j++) {
+            uint32_t offset = words[c->word + j];
+            argv[j] = offset < h->strings ? strings + offset : "";
+        }
+        argv[c->argc] = NULL;
+
+        if(aliased[c->name]) {
+            exec_alias(parser, &e, c->argc, argv, c->op);
+        } else {
+            exec_push(&e, c->argc, argv, c->op, resolved[c->name]);
+        }
+        exec_run(parser, &e, c->op != WS_END);
+        if(c->op == WS_END) {
+            retval = e.retval;
+            exec_free(&e);
+            e = (LT_Exec){0};
+        }
+    }
+    exec_free(&e);
+
+    // the last command's words are in the mapping
+    free_args(parser);
+    lt_free(resolved);
+    lt_free(aliased);
+    munmap(map, st.st_size);
+    return retval;
+}
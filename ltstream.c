@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+#include "ltalloc.h"
+#include "libtalaris.h"
+#include "ltoutput.h"
+#include <stdlib.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+
+typedef struct lt_chunk {
+    char *data;
+    size_t len;
+    struct lt_chunk *next;
+} LT_Chunk;
+
+struct lt_stream {
+    pthread_mutex_t lock;
+    pthread_cond_t readable, writable;
+    LT_Chunk *head, *tail;
+    int queued;
+    int capacity;
+    int closed;     /* the writer has finished */
+    int abandoned;  /* the reader has finished */
+
+    /* chunk currently being consumed by lt_stream_getline */
+    char *current;
+    size_t current_len, offset;
+};
+
+LT_Stream *lt_stream_create(int capacity) {
+    LT_Stream *s = lt_calloc(1, sizeof(LT_Stream));
+    assert(s);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->readable, NULL);
+    pthread_cond_init(&s->writable, NULL);
+    s->capacity = capacity > 0 ? capacity : LT_STREAM_CAPACITY;
+    return s;
+}
+
+void lt_stream_destroy(LT_Stream *s) {
+    if(s == NULL) return;
+    LT_Chunk *c = s->head;
+    while(c != NULL) {
+        LT_Chunk *next = c->next;
+        lt_free(c->data);
+        lt_free(c);
+        c = next;
+    }
+    lt_free(s->current);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->readable);
+    pthread_cond_destroy(&s->writable);
+    lt_free(s);
+}
+
+int lt_stream_push(LT_Stream *s, char *data, size_t len) {
+    /*
+     * Hands a malloc'd buffer over to the reader without copying it.
+     * Blocks while the stream is full. Returns -1 (and frees data)
+     * if the reader has gone away
+     */
+    if(data == NULL) return -1;
+    if(s == NULL) {
+        int retval = lt_stream_write(NULL, data, len);
+        lt_free(data);
+        return retval;
+    }
+    if(len == 0) {
+        lt_free(data);
+        return 0;
+    }
+    LT_Chunk *c = lt_malloc(sizeof(LT_Chunk));
+    assert(c);
+    c->data = data;
+    c->len = len;
+    c->next = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    while(s->queued >= s->capacity && !s->abandoned) {
+        pthread_cond_wait(&s->writable, &s->lock);
+    }
+    if(s->abandoned) {
+        pthread_mutex_unlock(&s->lock);
+        lt_free(data);
+        lt_free(c);
+        return -1;
+    }
+    if(s->tail) {
+        s->tail->next = c;
+    } else {
+        s->head = c;
+    }
+    s->tail = c;
+    s->queued++;
+    pthread_cond_signal(&s->readable);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+int lt_stream_write(LT_Stream *s, const char *data, size_t len) {
+    if(s == NULL) {
+        // the end of a pipeline writes to the call's output
+        LT_Output *o = output_current();
+        if(o) return output_write(o, data, len);
+        return fwrite(data, 1, len, stdout) == len ? 0 : -1;
+    }
+    char *copy = lt_malloc(len ? len : 1);
+    assert(copy);
+    memcpy(copy, data, len);
+    return lt_stream_push(s, copy, len);
+}
+
+int lt_stream_printf(LT_Stream *s, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    if(s == NULL) {
+        LT_Output *o = output_current();
+        int retval = o ? output_vprintf(o, format, args) : vprintf(format, args);
+        va_end(args);
+        return retval < 0 ? -1 : 0;
+    }
+    // sized first, so the chunk comes from lt_malloc like any other
+    va_list again;
+    va_copy(again, args);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if(len < 0) {
+        va_end(again);
+        return -1;
+    }
+    char *str = lt_malloc(len + 1);
+    assert(str);
+    vsnprintf(str, len + 1, format, again);
+    va_end(again);
+    return lt_stream_push(s, str, len);
+}
+
+static char *pop_chunk(LT_Stream *s, size_t *len) {
+    pthread_mutex_lock(&s->lock);
+    while(s->head == NULL && !s->closed) {
+        pthread_cond_wait(&s->readable, &s->lock);
+    }
+    LT_Chunk *c = s->head;
+    if(c == NULL) {
+        pthread_mutex_unlock(&s->lock);
+        return NULL;
+    }
+    s->head = c->next;
+    if(s->head == NULL) s->tail = NULL;
+    s->queued--;
+    pthread_cond_signal(&s->writable);
+    pthread_mutex_unlock(&s->lock);
+
+    char *data = c->data;
+    *len = c->len;
+    lt_free(c);
+    return data;
+}
+
+char *lt_stream_pull(LT_Stream *s, size_t *len) {
+    /*
+     * Takes the next chunk written to the stream. The caller owns
+     * the returned buffer. Returns NULL once the writer has closed
+     * the stream and everything has been read
+     */
+    assert(len);
+    if(s == NULL) return NULL;
+    if(s->current != NULL) {
+        // return whatever lt_stream_getline left of its chunk
+        char *data = s->current;
+        *len = s->current_len - s->offset;
+        memmove(data, data + s->offset, *len);
+        s->current = NULL;
+        if(*len > 0) return data;
+        lt_free(data);
+    }
+    return pop_chunk(s, len);
+}
+
+ssize_t lt_stream_getline(LT_Stream *s, char **line, size_t *cap) {
+    /*
+     * Reads up to and including the next newline into *line in the
+     * same way as getline(3). Returns -1 at the end of the stream
+     */
+    assert(line && cap);
+    if(s == NULL) return -1;
+    size_t len = 0;
+    for(;;) {
+        if(s->current == NULL || s->offset == s->current_len) {
+            lt_free(s->current);
+            s->offset = 0;
+            s->current = pop_chunk(s, &s->current_len);
+            if(s->current == NULL) break;
+        }
+        char *start = s->current + s->offset;
+        size_t avail = s->current_len - s->offset;
+        char *newline = memchr(start, '\n', avail);
+        size_t take = newline ? (size_t)(newline - start) + 1 : avail;
+
+        if(*line == NULL || *cap < len + take + 1) {
+            size_t new_cap = *cap ? *cap : 128;
+            while(new_cap < len + take + 1) new_cap *= 2;
+            *line = realloc(*line, new_cap);
+            assert(*line);
+            *cap = new_cap;
+        }
+        memcpy(*line + len, start, take);
+        len += take;
+        s->offset += take;
+        if(newline) break;
+    }
+    if(len == 0) return -1;
+    (*line)[len] = '\0';
+    return len;
+}
+
+void lt_stream_close(LT_Stream *s) {
+    /*
+     * Marks the end of the data. The reader sees end of stream
+     * once it has taken everything already written
+     */
+    if(s == NULL) return;
+    pthread_mutex_lock(&s->lock);
+    s->closed = 1;
+    pthread_cond_broadcast(&s->readable);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void lt_stream_abandon(LT_Stream *s) {
+    /*
+     * Called by the reader when it stops reading, so that a blocked
+     * writer fails instead of waiting forever
+     */
+    if(s == NULL) return;
+    pthread_mutex_lock(&s->lock);
+    s->abandoned = 1;
+    LT_Chunk *c = s->head;
+    while(c != NULL) {
+        LT_Chunk *next = c->next;
+        lt_free(c->data);
+        lt_free(c);
+        c = next;
+    }
+    s->head = s->tail = NULL;
+    s->queued = 0;
+    pthread_cond_broadcast(&s->writable);
+    pthread_mutex_unlock(&s->lock);
+}
@@ -1,150 +1,238 @@
+#include "ltalloc.h"
+#include "libtalaris.h"
 #include "wordsplit.h"
-#include "utlist.h"
 #include <ctype.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-typedef struct ws_list {
-    char *word;
-    struct ws_list *next, *prev;
-} WS_List;
-
-char *str_iterate(char *str) {
-    assert(str != NULL);
-    while(*str != '\0' && isspace(*str)) str++;
-    if(*str == '\0') return NULL;
-    int in_quote = 0;
-    int mid_word = 0;
-    if(*str == '"'){
-        in_quote = 1;
-        str++;
-    }
-    for(int i = 0; str[i] != '\0' && !isspace(str[i]); i++) {
-        if(str[i] == '"'){
-            in_quote = 1;
-            mid_word = 1;
-            break;
-        }
-    }
+static void *grow(void *array, int *cap, int need, size_t size) {
+    if(need <= *cap) return array;
+    int new_cap = *cap ? *cap : 16;
+    while(new_cap < need) new_cap *= 2;
+    array = lt_realloc(array, new_cap * size);
+    assert(array);
+    *cap = new_cap;
+    return array;
+}
 
-    if(mid_word) {
-        while(*str != '"') {
-            if(*str == '\0') return NULL;
-            str++;
-        }
-        str++;
+static void builder_putc(WS_Builder *b, char c) {
+    b->chars = grow(b->chars, &b->chars_cap, b->nchars + 1, sizeof(char));
+    b->chars[b->nchars++] = c;
+}
+
+static void builder_slot(WS_Builder *b, int offset) {
+    b->slots = grow(b->slots, &b->slots_cap, b->nslots + 1, sizeof(int));
+    b->slots[b->nslots++] = offset;
+}
+
+static char **builder_finish(WS_Builder *b) {
+    /*
+     * Pack the pointer table and the words into one allocation
+     */
+    size_t table = sizeof(char*) * b->nslots;
+    char **argv = lt_malloc(table + b->nchars);
+    assert(argv);
+    char *chars = (char*)argv + table;
+    if(b->nchars) memcpy(chars, b->chars, b->nchars);
+    for(int i = 0; i < b->nslots; i++) {
+        argv[i] = b->slots[i] < 0 ? NULL : chars + b->slots[i];
     }
-    if(in_quote) {
-        while(*str != '"') {
-            if(*str == '\0') return NULL;
-            str++;
-        }
+    lt_free(b->chars);
+    lt_free(b->slots);
+    return argv;
+}
+
+static ws_op operator_at(char *str, int *len) {
+    if(str[0] == ';') {
+        *len = 1;
+        return WS_SEQ;
     }
-    while(!isspace(*str)) {
-        if(*str == '\0') return NULL;
-        str++;
+    if(str[0] == '&' && str[1] == '&') {
+        *len = 2;
+        return WS_AND;
     }
-    while(isspace(*str)) {
-        if(*str == '\0') return NULL;
-        str++;
+    if(str[0] == '|') {
+        *len = str[1] == '|' ? 2 : 1;
+        return *len == 2 ? WS_OR : WS_PIPE;
     }
-    return str;
+    return WS_END;
 }
 
-char *end_of_word(char *str) {
-    assert(str != NULL);
-    char *next_word = str_iterate(str);
-    if(next_word == NULL) {
-        while(*str != '\0') str++;
-        return str;
-    }
-    next_word--;
-    while(isspace(*next_word)) {
-        next_word--;
-    }
-    next_word++;
-    return next_word;
+static int name_length(char *str) {
+    if(!isalpha((unsigned char)*str) && *str != '_') return 0;
+    int len = 1;
+    while(isalnum((unsigned char)str[len]) || str[len] == '_') len++;
+    return len;
 }
 
-void shuffle_down(char *str) {
-    assert(str);
-    char *next = str+1;
-    while(*str != '\0') {
-        *str = *next;
-        str++;
-        next++;
-    }
+static char *expand_variable(WS_Builder *b, char *str, ws_lookup lookup, void *ctx) {
+    /*
+     * str points at a '$'. Appends the value of the $NAME or ${NAME}
+     * there to b and returns the position after it, or NULL if str
+     * does not start a variable
+     */
+    char *name = str + 1;
+    int braced = *name == '{';
+    if(braced) name++;
+    int len = name_length(name);
+    if(len == 0 || (braced && name[len] != '}')) return NULL;
+
+    const char *value = lookup(name, len, ctx);
+    while(value != NULL && *value != '\0') builder_putc(b, *value++);
+    return name + len + braced;
 }
 
-void remove_quotes(char *str) {
-    assert(str);
-    while(*str != '\0') {
-        if(*str == '"') {
-            shuffle_down(str);
-        } else {
-            str++;
+static ws_op scan_command(WS_Scanner *scanner, WS_Builder *b, int *argc) {
+    /*
+     * Collects words into b until the end of the string or, with WS_CHAIN,
+     * a command separator. Quotes group words and are removed, and
+     * variables are expanded outside of single quotes
+     */
+    char *str = scanner->pos;
+    int flags = scanner->flags;
+    int len;
+    *argc = 0;
+    for(;;) {
+        while(isspace((unsigned char)*str)) str++;
+        if(*str == '\0') break;
+        if(flags & WS_CHAIN) {
+            ws_op op = operator_at(str, &len);
+            if(op != WS_END) {
+                scanner->pos = str + len;
+                return op;
+            }
+        }
+
+        int start = b->nchars;
+        int quoted = 0, expanded = 0;
+        char quote = '\0';
+        builder_slot(b, start);
+        while(*str != '\0') {
+            if(*str == quote) {
+                quote = '\0';
+                str++;
+                continue;
+            }
+            if(quote == '\0') {
+                if(*str == '"' || *str == '\'') {
+                    quote = *str++;
+                    quoted = 1;
+                    continue;
+                }
+                if(isspace((unsigned char)*str)) break;
+                if((flags & WS_CHAIN) && operator_at(str, &len) != WS_END) break;
+            }
+            if(*str == '$' && quote != '\'' && scanner->lookup != NULL) {
+                char *next = expand_variable(b, str, scanner->lookup, scanner->ctx);
+                if(next != NULL) {
+                    str = next;
+                    expanded = 1;
+                    continue;
+                }
+            }
+            builder_putc(b, *str++);
+        }
+        if(b->nchars == start && expanded && !quoted) {
+            // an unquoted word made only of empty variables disappears
+            b->nslots--;
+            continue;
         }
+        builder_putc(b, '\0');
+        (*argc)++;
     }
+    scanner->pos = str;
+    return WS_END;
 }
 
-WS_List *string_split(char *str) {
-    if(str == NULL) return NULL;
-    WS_List *words = NULL;
-    while(isspace(*str)) str++;
-    int len = strlen(str)-1;
-    for(int i = len; i <= 0 && isspace(str[i]); i--) {
-        str[i] = '\0';
-    }
-    char *start = str;
-    char *end;
-
-    while(start != NULL && *start != '\0') {
-        char *copy = strdup(start);
-        end = end_of_word(copy);
-        assert(end != NULL);
-        *end = '\0';
-        remove_quotes(copy);
-
-        WS_List *item = malloc(sizeof(WS_List));
-        assert(item);
-        item->word = copy;
-        DL_APPEND(words, item);
-        start = str_iterate(start);
-    }
-    return words;
+void ws_init(WS_Scanner *scanner, char *str, int flags) {
+    assert(scanner && str);
+    scanner->pos = str;
+    scanner->flags = flags;
+    scanner->lookup = NULL;
+    scanner->ctx = NULL;
 }
 
-void ws_free(WS_List *list) {
-    WS_List *word, *tmp;
-    DL_FOREACH_SAFE(list, word, tmp) {
-        DL_DELETE(list, word);
-        free(word->word);
-        free(word);
-    }
+int ws_next(WS_Scanner *scanner, char ***words, ws_op *op) {
+    /*
+     * Tokenizes the next command, leaving the scanner after its separator.
+     * *op is set to the separator, WS_END once the input is used up
+     */
+    assert(scanner && words && op);
+    WS_Builder b = {0};
+    int argc;
+    *op = scan_command(scanner, &b, &argc);
+    builder_slot(&b, -1);
+    *words = builder_finish(&b);
+    return argc;
+}
+
+int ws_chain(char *str, char ***words, WS_Range **ranges, ws_lookup lookup, void *ctx) {
+    /*
+     * Tokenizes a whole line in one pass. Every command's words are
+     * NULL terminated in *words and described by an entry in *ranges.
+     * Empty commands are dropped. Variables are expanded with lookup
+     * if it isn't NULL. Returns the number of ranges
+     */
+    assert(str && words && ranges);
+    WS_Scanner scanner;
+    WS_Builder b = {0};
+    WS_Range *list = NULL;
+    int count = 0, cap = 0;
+    ws_op op;
+    ws_init(&scanner, str, WS_CHAIN);
+    scanner.lookup = lookup;
+    scanner.ctx = ctx;
+    do {
+        int argc;
+        int start = b.nslots;
+        op = scan_command(&scanner, &b, &argc);
+        if(argc == 0) continue;
+        builder_slot(&b, -1);
+        list = grow(list, &cap, count + 1, sizeof(WS_Range));
+        list[count].start = start;
+        list[count].argc = argc;
+        list[count].op = op;
+        count++;
+    } while(op != WS_END);
+    if(b.nslots == 0) builder_slot(&b, -1);
+    *words = builder_finish(&b);
+    *ranges = list;
+    return count;
 }
 
 int ws_split(char *str, char ***words) {
     assert(str && words);
-    WS_List *ws = string_split(str);
-    WS_List *tmp;
-    int size = 0;
-    DL_COUNT(ws, tmp, size);
-
-    *words = malloc(sizeof(char*) * size);
-    int count = 0;
-    DL_FOREACH(ws, tmp) {
-        (*words)[count++] = strdup(tmp->word);
-    }
+    WS_Scanner scanner;
+    ws_op op;
+    ws_init(&scanner, str, 0);
+    return ws_next(&scanner, words, &op);
+}
+
+void ws_word(WS_Builder *b, const char *word) {
+    /*
+     * Adds a copy of word to a word list started with WS_Builder b = {0}
+     */
+    assert(b && word);
+    builder_slot(b, b->nchars);
+    while(*word != '\0') builder_putc(b, *word++);
+    builder_putc(b, '\0');
+}
 
-    ws_free(ws);
-    return size;
+char **ws_build(WS_Builder *b) {
+    /*
+     * Returns the NULL terminated word list, in the same form as ws_split
+     */
+    assert(b);
+    builder_slot(b, -1);
+    return builder_finish(b);
 }
 
 int ws_len(char *str) {
     if(str == NULL) return -1;
-    int count = 0;
-    while((str = str_iterate(str)) != NULL) count++;
+    char **words;
+    int count = ws_split(str, &words);
+    lt_free(words);
     return count;
 }
@@ -1,8 +1,51 @@
 #ifndef __WORDSPLIT
 #define __WORDSPLIT
-#include "utlist.h"
 
+/* scanner flags */
+#define WS_CHAIN 01 /* treat ; && || and | as command separators */
+
+typedef enum ws_op {
+    WS_END, /* end of input */
+    WS_SEQ, /* ; */
+    WS_AND, /* && */
+    WS_OR,  /* || */
+    WS_PIPE /* | */
+} ws_op;
+
+typedef struct ws_range {
+    int start;  /* index of the command's first word in argv */
+    int argc;
+    ws_op op;   /* operator following the command */
+} WS_Range;
+
+/* collects words into a word list, see ws_word and ws_build */
+typedef struct ws_builder {
+    char *chars;
+    int nchars, chars_cap;
+    int *slots; /* offset of each word in chars, -1 for a terminating NULL */
+    int nslots, slots_cap;
+} WS_Builder;
+
+/* returns the value of the variable named by the first len chars, or NULL */
+typedef const char *(*ws_lookup)(const char*, int, void*);
+
+typedef struct ws_scanner {
+    char *pos;
+    int flags;
+    ws_lookup lookup;   /* expands $NAME and ${NAME} when set */
+    void *ctx;
+} WS_Scanner;
+
+/*
+ * Word lists are returned as a single allocation: the NULL terminated
+ * pointer array followed by the words themselves. Release with lt_free().
+ */
+void ws_init(WS_Scanner*, char*, int);
+int ws_next(WS_Scanner*, char***, ws_op*);
+int ws_chain(char*, char***, WS_Range**, ws_lookup, void*);
 int ws_split(char*, char***);
+void ws_word(WS_Builder*, const char*);
+char **ws_build(WS_Builder*);
 int ws_len(char*);
 
 #endif